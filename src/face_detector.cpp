@@ -0,0 +1,106 @@
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include "face_detector.h"
+#include "opencv2/imgproc.hpp"
+
+// most faces kept per image
+constexpr int maxFaces = 256;
+// side of the blank image that initializes the detector weights
+constexpr int warmUpSize = 128;
+
+static void InitializeWeights() noexcept
+{
+    // objectdetect_cnn fills its weights on the first call without a lock, a single call made before any
+    // other leaves them read only, which makes concurrent calls safe
+    static std::once_flag initialized;
+    std::call_once(initialized, []() {
+        cv::Mat blank = cv::Mat::zeros(cv::Size(warmUpSize, warmUpSize), CV_8UC3);
+        objectdetect_cnn(blank.ptr(0), blank.cols, blank.rows, (int)blank.step);
+    });
+}
+
+FaceDetector::FaceDetector()
+{
+}
+
+static cv::Size DetectionSize(cv::Size size, cv::Size limitSize) noexcept
+{
+    // the largest size of the aspect ratio of size within limitSize
+    if (size.empty() || limitSize.empty())
+    {
+        return cv::Size();
+    }
+    const double scale = std::min(limitSize.width / (double)size.width, limitSize.height / (double)size.height);
+    return cv::Size(std::max(1, int(size.width * scale)), std::max(1, int(size.height * scale)));
+}
+
+std::vector<FaceRect> FaceDetector::Detect(const cv::Mat& image) noexcept
+{
+    if (mDetectBuffers.empty())
+    {
+        mDetectBuffers.resize(1);
+    }
+    return Detect(image, mDetectBuffers[0]);
+}
+
+std::vector<FaceRect> FaceDetector::Detect(const cv::Mat& image, cv::Mat& buffer) const noexcept
+{
+    std::vector<FaceRect> faces;
+    const cv::Size size = DetectionSize(image.size(), mLimitSize);
+    if (size.empty() || image.type() != CV_8UC3)
+    {
+        return faces;
+    }
+
+    const int elements = size.width * size.height;
+    if (buffer.cols < elements)
+    {
+        buffer.create(1, elements, CV_8UC3);
+    }
+    cv::Mat detectImage = buffer.colRange(0, elements).reshape(3, size.height);
+    cv::resize(image, detectImage, size, 0, 0, cv::INTER_CUBIC);
+    InitializeWeights();
+    faces = objectdetect_cnn(detectImage.ptr(0), detectImage.cols, detectImage.rows, (int)detectImage.step);
+    if (faces.size() > maxFaces)
+    {
+        faces.resize(maxFaces);
+    }
+
+    // back to the coordinates of the image
+    const float sx = (float)image.cols / size.width;
+    const float sy = (float)image.rows / size.height;
+    for (FaceRect& face : faces) {
+        face.x = int(face.x * sx);
+        face.y = int(face.y * sy);
+        face.w = int(face.w * sx);
+        face.h = int(face.h * sy);
+        for (int i = 0; i < 10; i += 2) {
+            face.lm[i] = int(face.lm[i] * sx);
+            face.lm[i + 1] = int(face.lm[i + 1] * sy);
+        }
+    }
+    return faces;
+}
+
+std::vector<std::vector<FaceRect>> FaceDetector::Detect(const std::vector<cv::Mat>& images) noexcept
+{
+    std::vector<std::vector<FaceRect>> faces(images.size());
+    const int threads = mThreadCount > 0 ? mThreadCount : cv::getNumThreads();
+    const int workers = std::max(1, std::min(threads, (int)images.size()));
+    if (mDetectBuffers.size() < size_t(workers))
+    {
+        mDetectBuffers.resize(workers);
+    }
+
+    // each worker has its own buffer and pulls the next image, so a slow image does not hold up the others
+    std::atomic<size_t> next{0};
+    cv::parallel_for_(cv::Range(0, workers), [&](const cv::Range& range) {
+        for (int w = range.start; w < range.end; ++w) {
+            for (size_t i = next++; i < images.size(); i = next++) {
+                faces[i] = Detect(images[i], mDetectBuffers[w]);
+            }
+        }
+    });
+    return faces;
+}
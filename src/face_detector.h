@@ -0,0 +1,29 @@
+#ifndef _FACE_DETECTOR_H_
+#define _FACE_DETECTOR_H_
+#include <vector>
+#include "opencv2/core.hpp"
+#include "facedetectcnn.h"
+
+// detector context: the model weights are shared by all contexts and only read once initialized, the buffers
+// of a detection are owned by the context and reused by the next one. Contexts run concurrently, a context
+// serves one caller at a time
+class FaceDetector {
+public:
+	explicit FaceDetector();
+	// faces of a bgr image in its own coordinates. The detector runs on the image scaled to fit the limit size
+	std::vector<FaceRect> Detect(const cv::Mat& image) noexcept;
+	// faces of each image of a batch, in the order of the images. Each image is a single detection, the images
+	// are spread over parallel_for_ workers that take the next one as they get done with one
+	std::vector<std::vector<FaceRect>> Detect(const std::vector<cv::Mat>& images) noexcept;
+	void SetLimitSize(cv::Size size) noexcept { mLimitSize = size; }
+	void SetThreadCount(int threads) noexcept { mThreadCount = threads; } // 0: cv::getNumThreads()
+private:
+	std::vector<FaceRect> Detect(const cv::Mat& image, cv::Mat& buffer) const noexcept;
+private:
+	cv::Size mLimitSize{300, 300};
+	int mThreadCount = 1;
+	// single row buffers that only grow, one per worker: the scaled image of each detection is a view into
+	// one of them, images up to the largest size so far are scaled without an allocation
+	std::vector<cv::Mat> mDetectBuffers{};
+};
+#endif
@@ -7,11 +7,20 @@
 #include "opencv2/highgui.hpp"
 #include <iostream>
 #include <filesystem>
+#include <chrono>
+#include <atomic>
+#include <future>
+#include <tuple>
 #include "utils.h"
 #include "seam_carver.h"
+#include "face_detector.h"
 using namespace std::filesystem;
 const char* algorithmItems[] = { "resize", "seam", "crop" };
 const int algorithmSize = 3;
+// images read and detected together by the face detection of an opened file list
+const int faceBatchSize = 16;
+// longest side of the image the live seam order maps are built on, the carved preview is scaled to the size
+const int retargetMaxSide = 640;
 
 struct Texture2D
 {
@@ -79,26 +88,20 @@ public:
 
 	cv::Mat GetMat() {return cv::imread(mPath);}
 	bool CheckEnableFindFaceAuto() { return mEnableFindFaceAuto; }
-	void FaceDetection(cv::Size limitSize, float limitConfident, std::vector<std::string>& debugLogs)
+	void FaceDetection(FaceDetector& detector, float limitConfident, std::vector<std::string>& debugLogs)
 	{
-		cv::Mat faceDetectImg;
-		ImVec2 newSize = GetScaleImageSize(ImVec2(mWidth, mHeight), ImVec2(limitSize.width, limitSize.height));
-		cv::resize(GetMat(), faceDetectImg, cv::Size(newSize.x, newSize.y), cv::INTER_CUBIC);
-
-		std::vector<FaceRect> faces = objectdetect_cnn((unsigned char*)(faceDetectImg.ptr(0)), faceDetectImg.cols, faceDetectImg.rows, (int)faceDetectImg.step);
-		int num_faces =(int)faces.size();
-		num_faces = MIN(num_faces, 256);
-		cv::Mat faceDetectImgResult = faceDetectImg.clone();
-		for (int i = 0; i < num_faces; i++)
+		SetFaces(detector.Detect(GetMat()), limitConfident, debugLogs);
+	}
+
+	// keeps the detected faces above the confidence, faces in the coordinates of the image
+	void SetFaces(const std::vector<FaceRect>& faces, float limitConfident, std::vector<std::string>& debugLogs)
+	{
+		mFaces.clear();
+		for (int i = 0; i < faces.size(); i++)
 		{
 			cv::Rect faceROI = {faces[i].x, faces[i].y, faces[i].w, faces[i].h};
-			if(faces[i].score > limitConfident && faceROI.area() < faceDetectImg.size().area())
+			if(faces[i].score > limitConfident && faceROI.area() < mWidth * mHeight)
 			{
-				//show the score of the face. Its range is [0-100]
-				std::string sScore = std::format("{:.2f}", faces[i].score);
-				cv::putText(faceDetectImgResult, sScore, cv::Point(faceROI.x, faceROI.y-3), cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(0, 255, 0), 1);
-				//draw face rectangle
-				cv::rectangle(faceDetectImgResult, faceROI, cv::Scalar(0, 255, 0), 2);
 				mFaces.emplace_back(faces[i]);
 			}
 			//print the result
@@ -106,18 +109,6 @@ public:
 					i, faces[i].score, faces[i].x, faces[i].y, faces[i].w, faces[i].h);
 			debugLogs.push_back(logStr);
 		}
-
-		for (int i = 0; i < mFaces.size(); i++)
-		{
-			cv::Rect oriFace = GetScaleRect(cv::Rect(mFaces[i].x, mFaces[i].y, mFaces[i].w, mFaces[i].h), cv::Size(mWidth, mHeight), faceDetectImg.size());
-			mFaces[i].x = oriFace.x;
-			mFaces[i].y = oriFace.y;
-			mFaces[i].w = oriFace.width;
-			mFaces[i].h = oriFace.height;
-		}
-
-		faceDetectImgResult.release();
-		faceDetectImg.release();
 		mEnableFindFaceAuto = false;
 	}
 private:
@@ -158,12 +149,14 @@ public:
 						mImageList.clear();
 						mCurrentMat.release();
 						mResizeMat.release();
+						mRetargetPreview.release();
 						mPreviousIdex = mCurrentIdex = 0;
 						for (size_t i = 0; i < NFD_PathSet_GetCount(&outPaths); ++i)
 						{
 							nfdchar_t *outPath = NFD_PathSet_GetPath(&outPaths, i);
 							mImageList.push_back(CreateRef<ImageInfo>(outPath));
 						}
+						DetectFacesAsync();
 					}
 					else if (result == NFD_CANCEL)
 					{
@@ -188,6 +181,7 @@ public:
 						mPreviousIdex = mCurrentIdex = 0;
 						mCurrentMat.release();
 						mResizeMat.release();
+						mRetargetPreview.release();
 						std::vector<std::string> extensions = { ".jpg", ".JPG", ".png", ".PNG" };
 						for (const auto& entry : std::filesystem::directory_iterator(outPath)) {
 							if (entry.is_regular_file()) {
@@ -201,6 +195,7 @@ public:
 							}
 						}
 						free(outPath);
+						DetectFacesAsync();
 					}
 					else if ( result == NFD_CANCEL )
 					{
@@ -316,13 +311,13 @@ public:
 			ImGuiContext &g = *GImGui;
 			ImGui::TextUnformatted("width:");
 			ImGui::SameLine(0, g.Style.ItemInnerSpacing.x);
-			ImGui::DragFloat("##hidelabel", &mWidth, 0.1f, 1.0f, 100.0f);
+			bool sizeChanged = ImGui::DragFloat("##hidelabel", &mWidth, 0.1f, 1.0f, 100.0f);
 			ImGui::PopID();
 			ImGui::PushID("height");
 			ImGui::SameLine(0, g.Style.ItemInnerSpacing.x);
 			ImGui::TextUnformatted("height:");
 			ImGui::SameLine(0, g.Style.ItemInnerSpacing.x);
-			ImGui::DragFloat("##hidelabel", &mHeight, 0.1f, 1.0f, 100.0f);
+			sizeChanged |= ImGui::DragFloat("##hidelabel", &mHeight, 0.1f, 1.0f, 100.0f);
 			ImGui::PopItemWidth();
 			ImGui::PopID();
 			ImGui::PushID("Combo");
@@ -330,10 +325,39 @@ public:
 			ImGui::SameLine(0, g.Style.ItemInnerSpacing.x);
 			ImGui::Combo("##hidelabel", &mAlgorithmItem, algorithmItems, algorithmSize);
 			ImGui::PopID();
+			if (mAlgorithmItem == 1)
+			{
+				ImGui::PushID("seambatch");
+				ImGui::TextUnformatted("seams per pass:");
+				ImGui::SameLine(0, g.Style.ItemInnerSpacing.x);
+				ImGui::DragInt("##hidelabel", &mSeamBatchSize, 1, 1, 64);
+				ImGui::PopID();
+				ImGui::PushID("seampyramid");
+				ImGui::TextUnformatted("pyramid levels:");
+				ImGui::SameLine(0, g.Style.ItemInnerSpacing.x);
+				ImGui::DragInt("##hidelabel", &mSeamPyramidLevels, 1, 0, 4);
+				ImGui::PopID();
+				ImGui::PushID("seambudget");
+				ImGui::TextUnformatted("scratch budget (MB, 0: none):");
+				ImGui::SameLine(0, g.Style.ItemInnerSpacing.x);
+				ImGui::DragInt("##hidelabel", &mSeamScratchBudget, 1, 0, 4096);
+				ImGui::PopID();
+				ImGui::Checkbox("forward energy", &mSeamForwardEnergy);
+				ImGui::Checkbox("enlarge by seam insertion", &mSeamInsertion);
+				ImGui::Checkbox("optimal seam order", &mSeamOptimalOrder);
+				ImGui::Checkbox("remove detected faces", &mSeamRemoveFaces);
+				ImGui::Checkbox("keep seams off protected areas", &mSeamRestrictedSearch);
+				ImGui::Checkbox("follow the seams of the last resize", &mSeamTemporalCoherence);
+				ImGui::Checkbox("debug windows", &mSeamDebugWindows);
+			}
 			if(ImGui::Button("resize"))
 			{
 				ResizeImage();
 			}
+			else if ((sizeChanged || mRetargetTask.valid()) && mAlgorithmItem == 1)
+			{
+				RetargetImage();
+			}
 
 			//if(mEnableFaceDetection)
 			{
@@ -341,7 +365,12 @@ public:
 				ImGui::PushID("Face");
 				if(ImGui::Button("face detection"))
 				{
-					if(!mImageList.empty()) mImageList[mCurrentIdex]->FaceDetection(resizeFaceDetection, mLimitConfident, debugLog);
+					if(!mImageList.empty() && !mFaceBatch.valid())
+					{
+						mFaceDetector.SetLimitSize(resizeFaceDetection);
+						mImageList[mCurrentIdex]->FaceDetection(mFaceDetector, mLimitConfident, debugLog);
+					}
+					mRetargetGeneration = -1;
 				}
 				ImGui::PopID();
 				ImGui::PushMultiItemsWidths(2, ImGui::CalcItemWidth());
@@ -363,6 +392,10 @@ public:
 				ImGui::DragFloat("##hidelabel", &mLimitConfident, 0.01f, 0.0f, 1.0f);
 				ImGui::PopItemWidth();
 				ImGui::PopID();
+				if(ImGui::Button("benchmark detection threads"))
+				{
+					if(!mImageList.empty() && !mFaceBatch.valid() && !mFaceBenchmark.valid()) BenchmarkFaceDetection();
+				}
 			}
 			ImGui::End();
 		}
@@ -407,6 +440,7 @@ public:
 					mPreviousIdex = mCurrentIdex;
 					mCurrentIdex = i;
 					mCurrentMat.release();
+					mRetargetPreview.release();
 				}
 
 				if(i == mCurrentIdex)
@@ -456,10 +490,13 @@ public:
 				ImGui::SetCursorPos(image_pos);
 				ImGui::Image((void *)(intptr_t)mImageList[mCurrentIdex]->GetTexture().id, image_size);
 
+				CollectFaceBatch();
+				CollectFaceBenchmark();
 				auto faces = mImageList[mCurrentIdex]->GetFaces();
-				if(faces.empty() && mImageList[mCurrentIdex]->CheckEnableFindFaceAuto())
+				if(faces.empty() && mImageList[mCurrentIdex]->CheckEnableFindFaceAuto() && !mFaceBatch.valid())
 				{
-					mImageList[mCurrentIdex]->FaceDetection(resizeFaceDetection, mLimitConfident, debugLog);
+					mFaceDetector.SetLimitSize(resizeFaceDetection);
+					mImageList[mCurrentIdex]->FaceDetection(mFaceDetector, mLimitConfident, debugLog);
 				}
 				else
 				{
@@ -509,6 +546,13 @@ public:
 
 	void SaveFile(std::string path)
 	{
+		// a live retarget shows a preview, the saved image is carved at full resolution
+		if (!mRetargetPreview.empty())
+		{
+			ResizeImage();
+			Inspection();
+		}
+
 		// Bind the texture
 		glBindTexture(GL_TEXTURE_2D, mTexture.id);
 
@@ -533,6 +577,199 @@ public:
 	{
 	}
 
+	// detects the faces of every opened image off the ui loop, faceBatchSize images per detector batch
+	void DetectFacesAsync()
+	{
+		std::vector<std::string> paths;
+		for (auto& img : mImageList) paths.push_back(img->GetPath());
+		CancelFaceTasks();
+		mFaceBatchCancel = std::make_shared<std::atomic<bool>>(false);
+		mFaceBatch = std::async(std::launch::async, [paths, cancel = mFaceBatchCancel, limitSize = resizeFaceDetection]()
+		{
+			FaceDetector detector;
+			detector.SetLimitSize(limitSize);
+			detector.SetThreadCount(0);
+			std::vector<std::vector<FaceRect>> faces;
+			std::vector<cv::Mat> images;
+			for (size_t i = 0; i < paths.size() && !*cancel; i += faceBatchSize)
+			{
+				images.clear();
+				for (size_t j = i; j < std::min(paths.size(), i + faceBatchSize); j++) {
+					images.push_back(cv::imread(paths[j]));
+				}
+				auto batch = detector.Detect(images);
+				std::move(batch.begin(), batch.end(), std::back_inserter(faces));
+			}
+			return faces;
+		});
+		mFaceBatchImages = mImageList;
+	}
+
+	// a pending batch or benchmark of the previous list stops after its current images, the faces are dropped
+	void CancelFaceTasks()
+	{
+		if (mFaceBatchCancel) mFaceBatchCancel->store(true);
+		if (mFaceBenchmarkCancel) mFaceBenchmarkCancel->store(true);
+		if (mFaceBatch.valid()) mRetiredFaceBatches.push_back(std::move(mFaceBatch));
+		mFaceBatchImages.clear();
+	}
+
+	// hands the faces of a finished batch to its images
+	void CollectFaceBatch()
+	{
+		std::erase_if(mRetiredFaceBatches, [](auto& batch) { return batch.wait_for(std::chrono::seconds(0)) == std::future_status::ready; });
+		if (!mFaceBatch.valid() || mFaceBatch.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			return;
+		}
+		auto faces = mFaceBatch.get();
+		for (size_t i = 0; i < faces.size() && i < mFaceBatchImages.size(); i++)
+		{
+			mFaceBatchImages[i]->SetFaces(faces[i], mLimitConfident, debugLog);
+		}
+		// the faces protect the seams of the live retarget
+		mRetargetGeneration = -1;
+		mFaceBatchImages.clear();
+	}
+
+	// detection throughput over the opened images from one thread up to all of them, in the debug log. The
+	// sweep runs on a background task, the images are read faceBatchSize at a time and only detection is timed
+	void BenchmarkFaceDetection()
+	{
+		std::vector<std::string> paths;
+		for (auto& img : mImageList) paths.push_back(img->GetPath());
+		mFaceBenchmarkCancel = std::make_shared<std::atomic<bool>>(false);
+		mFaceBenchmark = std::async(std::launch::async, [paths, cancel = mFaceBenchmarkCancel, limitSize = resizeFaceDetection]()
+		{
+			std::vector<std::string> logs;
+			std::vector<cv::Mat> images;
+			// the first detection initializes the weights, it stays out of the timings
+			FaceDetector().Detect(cv::imread(paths[0]));
+			const int maxThreads = cv::getNumThreads();
+			for (int threads = 1; ; threads = std::min(threads * 2, maxThreads))
+			{
+				FaceDetector detector;
+				detector.SetLimitSize(limitSize);
+				detector.SetThreadCount(threads);
+				double elapsed = 0;
+				for (size_t i = 0; i < paths.size() && !*cancel; i += faceBatchSize)
+				{
+					images.clear();
+					for (size_t j = i; j < std::min(paths.size(), i + faceBatchSize); j++) {
+						images.push_back(cv::imread(paths[j]));
+					}
+					auto start = std::chrono::steady_clock::now();
+					detector.Detect(images);
+					elapsed += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+				}
+				if (*cancel) break;
+				logs.push_back(std::format("face detection, {} threads: {:.1f} images/s", threads, paths.size() * 1000.0 / elapsed));
+				if (threads == maxThreads) break;
+			}
+			return logs;
+		});
+	}
+
+	// moves the results of a finished benchmark to the debug log
+	void CollectFaceBenchmark()
+	{
+		if (!mFaceBenchmark.valid() || mFaceBenchmark.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			return;
+		}
+		for (auto& log : mFaceBenchmark.get()) debugLog.push_back(log);
+	}
+
+	cv::Mat CreateProtectionMask()
+	{
+		cv::Mat protectMat;
+		auto faces = mImageList[mCurrentIdex]->GetFaces();
+		if (!faces.empty())
+		{
+			protectMat = cv::Mat::zeros(mCurrentMat.size(), CV_8UC1);
+			for (int i = 0; i < faces.size(); i++)
+			{
+				cv::Rect faceROI = { faces[i].x, faces[i].y, faces[i].w, faces[i].h };
+				//show the score of the face. Its range is [0-100]
+				//std::string sScore = std::format("{:.2f}", faces[i].score);
+				//cv::putText(tmpImg, sScore, cv::Point(faceROI.x, faceROI.y-13), cv::FONT_HERSHEY_SIMPLEX, 2.5, cv::Scalar(0, 255, 0), 10);
+				//draw face rectangle
+				//cv::rectangle(tmpImg, faceROI, cv::Scalar(0, 255, 0), 10);
+				cv::rectangle(protectMat, faceROI, cv::Scalar(255), -1);
+			}
+		}
+		return protectMat;
+	}
+
+	// live seam carving while the size is dragged: the seam order maps are built once per image and settings,
+	// on a background task at preview scale, after that every size is a single gather pass
+	void RetargetImage()
+	{
+		cv::Size size = cv::Size(cm2pixel(mWidth), cm2pixel(mHeight));
+		if (size.empty() || mImageList.empty() || mCurrentMat.empty())
+		{
+			return;
+		}
+
+		if (mRetargetTask.valid())
+		{
+			if (mRetargetTask.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			{
+				// the last preview stays until the maps are ready
+				return;
+			}
+			mRetargetCarver = mRetargetTask.get();
+			double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - mRetargetStart).count();
+			debugLog.push_back(std::format("seam: order maps of {}x{} in {:.1f} ms", mRetargetSize.width, mRetargetSize.height, elapsed));
+		}
+
+		auto settings = std::make_tuple(mSeamBatchSize, mSeamPyramidLevels, mSeamForwardEnergy);
+		if (mRetargetGeneration != mImageGeneration || mRetargetSettings != settings)
+		{
+			mRetargetGeneration = mImageGeneration;
+			mRetargetSize = mCurrentMat.size();
+			mRetargetSettings = settings;
+			mRetargetCarver = SeamCarver();
+			mRetargetStart = std::chrono::steady_clock::now();
+			mRetargetTask = std::async(std::launch::async, [source = mCurrentMat, mask = CreateProtectionMask(), settings]()
+			{
+				cv::Mat image = source;
+				cv::Mat protect = mask;
+				const double scale = retargetMaxSide / (double)std::max(source.cols, source.rows);
+				if (scale < 1.0)
+				{
+					cv::resize(source, image, cv::Size(), scale, scale, cv::INTER_AREA);
+					if (!mask.empty()) cv::resize(mask, protect, image.size(), 0, 0, cv::INTER_NEAREST);
+				}
+				SeamCarver carver;
+				carver.SetKernelSize(3);
+				carver.SetBatchSize(std::get<0>(settings));
+				carver.SetPyramidLevels(std::get<1>(settings));
+				carver.SetEnergyType(std::get<2>(settings) ? SeamEnergyType::FORWARD_ENERGY : SeamEnergyType::MIN_ENERGY);
+				carver.SetThreadCount(0);
+				carver.SetProtectionMask(protect);
+				carver.PrecomputeSeamOrder(image);
+				return carver;
+			});
+			return;
+		}
+
+		// a preview at the scale of the maps, mResizeMat stays as it is until the full resize
+		mRetargetPreview = mRetargetCarver.Retarget(size);
+	}
+
+	static void ShowSeamDebug(const char* name, const cv::Mat& image)
+	{
+		cv::Mat view = image;
+		if (image.depth() == CV_16U)
+		{
+			image.convertTo(view, CV_8U);
+			cv::applyColorMap(view, view, cv::COLORMAP_JET);
+		}
+		cv::namedWindow(std::string("debug ") + name, cv::WINDOW_FREERATIO);
+		cv::imshow(std::string("debug ") + name, view);
+	}
+
 	void ResizeImage()
 	{
 		cv::Scalar bgColor = vec2scalar(mBgColor);
@@ -543,6 +780,7 @@ public:
 			if (!mImageList.empty())
 			{
 				mResizeMat.release();
+				mRetargetPreview.release();
 				// if(mText.cols > mText.rows)
 				// {
 				// 	cv::rotate(mText, mText, cv::ROTATE_90_CLOCKWISE);
@@ -551,22 +789,7 @@ public:
 
 				cv::Mat tmpImg = mCurrentMat.clone();
 
-				cv::Mat protectMat;
-				auto faces = mImageList[mCurrentIdex]->GetFaces();
-				if (!faces.empty())
-				{
-					protectMat = cv::Mat::zeros(mCurrentMat.size(), CV_8UC1);
-					for (int i = 0; i < faces.size(); i++)
-					{
-						cv::Rect faceROI = { faces[i].x, faces[i].y, faces[i].w, faces[i].h };
-						//show the score of the face. Its range is [0-100]
-						//std::string sScore = std::format("{:.2f}", faces[i].score);
-						//cv::putText(tmpImg, sScore, cv::Point(faceROI.x, faceROI.y-13), cv::FONT_HERSHEY_SIMPLEX, 2.5, cv::Scalar(0, 255, 0), 10);
-						//draw face rectangle
-						//cv::rectangle(tmpImg, faceROI, cv::Scalar(0, 255, 0), 10);
-						cv::rectangle(protectMat, faceROI, cv::Scalar(255), -1);
-					}
-				}
+				cv::Mat protectMat = CreateProtectionMask();
 
 				if (mAlgorithmItem == 0)
 				{
@@ -574,12 +797,29 @@ public:
 				}
 				else if (mAlgorithmItem == 1)
 				{
-					SeamCarver seamCarver;
+					// the carver keeps its buffers between resizes, only the settings are renewed
+					SeamCarver& seamCarver = mSeamCarver;
 					seamCarver.SetSize(size);
 					seamCarver.SetKernelSize(3);
-					seamCarver.SetProtectionMask(protectMat);
+					seamCarver.SetBatchSize(mSeamBatchSize);
+					seamCarver.SetPyramidLevels(mSeamPyramidLevels);
+					seamCarver.SetEnergyType(mSeamForwardEnergy ? SeamEnergyType::FORWARD_ENERGY : SeamEnergyType::MIN_ENERGY);
+					seamCarver.SetSeamInsertion(mSeamInsertion);
+					seamCarver.SetOptimalOrder(mSeamOptimalOrder);
+					seamCarver.SetRestrictedSearch(mSeamRestrictedSearch);
+					seamCarver.SetTemporalCoherence(mSeamTemporalCoherence);
+					seamCarver.SetScratchBudget(size_t(mSeamScratchBudget) << 20);
+					seamCarver.SetDebugCallback(mSeamDebugWindows ? SeamDebugCallback(ShowSeamDebug) : SeamDebugCallback());
+					seamCarver.SetThreadCount(0);
+					seamCarver.SetRemovalMask(mSeamRemoveFaces ? protectMat : cv::Mat());
+					seamCarver.SetProtectionMask(mSeamRemoveFaces ? cv::Mat() : protectMat);
+					auto start = std::chrono::steady_clock::now();
 					seamCarver.Inspection(tmpImg);
+					double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 					mResizeMat = seamCarver.GetCarvedImage();
+					int seams = seamCarver.GetSeamCount();
+					debugLog.push_back(std::format("seam: {} seams in {:.1f} ms ({:.3f} ms/seam)", seams, elapsed, seams ? elapsed / seams : 0.0));
+					if (seamCarver.ExceedsScratchBudget()) debugLog.push_back(std::format("seam: the working maps alone exceed the scratch budget of {} MB", mSeamScratchBudget));
 				}
 				tmpImg.release();
 			}
@@ -591,26 +831,30 @@ public:
 		cv::Scalar bgColor = vec2scalar(mBgColor);
 		cv::Size size = cv::Size(cm2pixel(mWidth), cm2pixel(mHeight));
 		if(mResizeMat.empty()) mResizeMat = cv::Mat(size, CV_8UC3, bgColor);
+		const cv::Mat& shown = mRetargetPreview.empty() ? mResizeMat : mRetargetPreview;
 
 		// crash when input width, height
-		if (!mResizeMat.empty())
+		if (!shown.empty())
 		{
 			if (!mImageList.empty())
 				if (mPreviousIdex != mCurrentIdex || mCurrentMat.empty())
+				{
 					mCurrentMat = mImageList[mCurrentIdex]->GetMat();
+					mImageGeneration++;
+				}
 
 			// update OpenGL texture if size has changed
-			if (mResizeMat.cols != mTexture.width || mResizeMat.rows != mTexture.height)
+			if (shown.cols != mTexture.width || shown.rows != mTexture.height)
 			{
 				ImageRelease(mTexture);
-				mTexture = ImageInfo::CreateTexture(cv::Mat::zeros(mResizeMat.size(), CV_8UC3));
-				mTexture.width = mResizeMat.cols;
-				mTexture.height = mResizeMat.rows;
+				mTexture = ImageInfo::CreateTexture(cv::Mat::zeros(shown.size(), CV_8UC3));
+				mTexture.width = shown.cols;
+				mTexture.height = shown.rows;
 				// glTexImage2D(GL_TEXTURE_2D, 0, GL_BGR, mTexture.width, mTexture.height, 0, GL_BGR, GL_UNSIGNED_BYTE, NULL);
 			}
 
 			cv::Mat resizedMat;
-			cv::resize(mResizeMat, resizedMat, cv::Size(mTexture.width, mTexture.height));
+			cv::resize(shown, resizedMat, cv::Size(mTexture.width, mTexture.height));
 
 			glBindTexture(GL_TEXTURE_2D, (GLuint)(intptr_t)mTexture.id);
 
@@ -638,16 +882,20 @@ public:
 		mImageList.clear();
 		mCurrentIdex = mPreviousIdex = 0;
 		mCurrentMat.release();
+		mRetargetPreview.release();
 		mWidth = 6;
 		mHeight = 9;
 		mBgColor = {1.0f, 1.0f, 1.0f, 1.0f};
 		ImageRelease(mTexture);
 		mTexture = ImageInfo::CreateTexture(cv::Mat::zeros(cv::Size(cm2pixel(mWidth), cm2pixel(mHeight)), CV_8UC3));
+		mSeamCarver.Release();
+		CancelFaceTasks();
 		debugLog.clear();
 	}
 
 	~Application()
 	{
+		CancelFaceTasks();
 		ImageRelease(mTexture);
 		for (auto &image : mImageList)
 			image->Release();
@@ -664,12 +912,38 @@ private:
 	float mHeight = 9;
 	ImVec4 mBgColor = {1.0f, 1.0f, 1.0f, 1.0f};
 	std::vector<Ref<ImageInfo>> mImageList{};
+	std::future<std::vector<std::vector<FaceRect>>> mFaceBatch{};  // faces of mFaceBatchImages, pending while valid
+	std::vector<Ref<ImageInfo>> mFaceBatchImages{};
+	std::shared_ptr<std::atomic<bool>> mFaceBatchCancel{};
+	std::vector<std::future<std::vector<std::vector<FaceRect>>>> mRetiredFaceBatches{};  // cancelled, until they stop
+	std::future<std::vector<std::string>> mFaceBenchmark{};  // debug log lines of the benchmark, pending while valid
+	std::shared_ptr<std::atomic<bool>> mFaceBenchmarkCancel{};
+	FaceDetector mFaceDetector;
 	int mCurrentIdex;
 	int mPreviousIdex;
 	cv::Mat mCurrentMat;
 	cv::Mat mResizeMat;
+	cv::Mat mRetargetPreview;  // live retarget at the scale of its order maps, shown over mResizeMat
 	Texture2D mTexture;
 	int mAlgorithmItem = 0;
+	int mSeamBatchSize = 1;
+	int mSeamPyramidLevels = 0;
+	int mSeamScratchBudget = 0;
+	bool mSeamForwardEnergy = false;
+	bool mSeamInsertion = false;
+	bool mSeamOptimalOrder = false;
+	bool mSeamRemoveFaces = false;
+	bool mSeamRestrictedSearch = false;
+	bool mSeamTemporalCoherence = false;
+	bool mSeamDebugWindows = false;
+	SeamCarver mSeamCarver;
+	SeamCarver mRetargetCarver;
+	int mImageGeneration = 0;                       // counts the images loaded into mCurrentMat
+	int mRetargetGeneration = -1;                   // image and settings of the pending or last order maps, -1: none
+	std::tuple<int, int, bool> mRetargetSettings{};
+	cv::Size mRetargetSize{};
+	std::future<SeamCarver> mRetargetTask{};
+	std::chrono::steady_clock::time_point mRetargetStart{};
 	bool mEnableFaceDetection = false;
 	float mLimitConfident = 0.5;
 	float mPreviousLimitConfident = 0.5;
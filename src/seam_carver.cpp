@@ -1,274 +1,1679 @@
-#include "utils.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <type_traits>
 #include "seam_carver.h"
-#include "opencv2/highgui.hpp"
+#include "seam_kernels.h"
 #include "opencv2/imgproc.hpp"
 
+// parallel dp: rows per band (one synchronization per band) and the narrowest tile worth a thread
+constexpr int dpBandRows = 32;
+constexpr int dpMinTileWidth = 128;
+// energy added to every pixel outside the removal mask: the same as a strongly negative energy under the
+// mask, without leaving the unsigned energy range. Seams are searched this far around the mask
+constexpr int removalBias = 4096;
+constexpr int removalSlack = 16;
+// protection mask value from which a pixel is a barrier of the restricted search
+constexpr int protectedLevel = 128;
+// dp cost of a barrier cell: far off any real path, but still better than the sentinels so that a
+// backtrack through a barrier never leaves the table
+template <SeamEnergyType energy_type>
+constexpr int32_t barrierCost = SeamEnergyTraits<energy_type>::worst / 2;
+// sequence frames: how far a seam may move from its place in the previous frame, and the mean gray
+// difference per pixel up to which a frame counts as a continuation of the previous one
+constexpr int sequenceBand = 4;
+constexpr int sequenceMaxDifference = 8;
+// fewest rows of a sobel strip of CalcEnergyMap under a scratch budget
+constexpr int energyMinStripRows = 16;
+// largest transport map side of the optimal seam order, every cell costs two seam searches
+constexpr int transportMaxSteps = 32;
+// a workspace this many times larger than an image needs is released before the image is carved
+constexpr size_t workspaceTrim = 4;
+
 SeamCarver::SeamCarver()
 {
 }
 
+static cv::Mat WorkspaceView(cv::Mat& buffer, cv::Size size, int type) noexcept
+{
+    // a map of the given size at the start of a single row buffer, which only grows. The views share the
+    // buffer, a map keeps the memory it was made from even if the buffer grows later
+    const int elements = size.width * size.height;
+    if (buffer.type() != type || buffer.cols < elements)
+    {
+        buffer.create(1, std::max(elements, buffer.type() == type ? buffer.cols : 0), type);
+    }
+    return buffer.colRange(0, elements).reshape(CV_MAT_CN(type), size.height);
+}
+
+static size_t BufferBytes(const cv::Mat& buffer) noexcept
+{
+    return buffer.total() * buffer.elemSize();
+}
+
+static bool InBuffer(const cv::Mat& map, const cv::Mat& buffer) noexcept
+{
+    return !buffer.empty() && map.data >= buffer.data && map.data < buffer.data + BufferBytes(buffer);
+}
+
+cv::Mat SeamCarver::MapBuffer(int map, cv::Size size, int type, const cv::Mat& source) noexcept
+{
+    // a workspace view for a new version of a working map (0: carved image, 1: protection mask, 2: removal
+    // mask, 3: index map, 4: gray image, 5: energy map), in the buffer of the pair that source does not use
+    cv::Mat* buffers = &mMapBuffers[2 * map];
+    return WorkspaceView(buffers[InBuffer(source, buffers[0]) ? 1 : 0], size, type);
+}
+
+void SeamCarver::Release() noexcept
+{
+    // the workspace and the dp tables go, the result, the masks and the seam order maps stay. Masks that are
+    // views into the workspace are copied out of it
+    if (std::any_of(std::begin(mMapBuffers), std::end(mMapBuffers), [this](const cv::Mat& buffer) { return InBuffer(mProtectionMask, buffer); }))
+        mProtectionMask = mProtectionMask.clone();
+    if (std::any_of(std::begin(mMapBuffers), std::end(mMapBuffers), [this](const cv::Mat& buffer) { return InBuffer(mRemovalMask, buffer); }))
+        mRemovalMask = mRemovalMask.clone();
+    for (cv::Mat& buffer : mMapBuffers) buffer.release();
+    for (cv::Mat& buffer : mSobelBuffers) buffer.release();
+    for (cv::Mat& buffer : mPyramidBuffers) buffer.release();
+    for (cv::Mat& buffer : mStepBuffers) buffer.release();
+    mGrayBuffer.release();
+    mEnergyBuffer.release();
+    mGrayImage.release();
+    mEnergyMap.release();
+    mIndexMap.release();
+    mPyramidEnergy.release();
+    mDPGray.release();
+    mCostMap = {};
+    mParentMap = {};
+    mCheckpoints = {};
+    mReplayCost = {};
+    mSeamTaken = {};
+    mCostLine = {};
+    mTileCost = {};
+    mTileParent = {};
+    mSeamMask = {};
+    mDPValid = false;
+}
+
 void SeamCarver::Inspection(const cv::Mat &input) noexcept
 {
     if (!input.empty())
     {
         //mOriginImage = input.clone();
+        // a workspace left by a much larger image is given back before this one is carved
+        if (mMapBuffers[0].total() > workspaceTrim * std::max<size_t>(input.total(), mSize.area()))
+        {
+            Release();
+        }
+        mSeamCount = 0;
+        mBudgetExceeded = false;
+        mEnergyMap.release();
+        mDPValid = false;
+        mSpansValid = false;
+        mTransposed = false;
         mCarvedImage= CalcCarvedImage(input, mSize);
+        const bool sequence = mTemporalCoherence && mRemovalMask.empty();
+        const bool coherent = sequence && MatchesSequence(input);
+        mRecordSequence = sequence && !coherent;
+        if (mRecordSequence)
+        {
+            mSequenceSteps.clear();
+            mSequenceSeams.clear();
+        }
+        if (coherent)
+        {
+            CarveSequenceFrame();
+        }
+        if (!mRemovalMask.empty())
+        {
+            // the seams inserted by the loop below bring the image back to the target size
+            RemoveObject();
+        }
+        cv::Size carved = CarvedSize();
+        if (!coherent && mOptimalOrder && carved.width > mSize.width && carved.height > mSize.height)
+        {
+            CarveOptimalOrder(carved.height - mSize.height, carved.width - mSize.width);
+        }
         while(CheckFinishCarved())
         {
-            std::vector<int>* seam = new std::vector<int>();
-            if (mDirection == SeamDirection::VERTICAL)
-            {
-                FindVerticalSeam(seam);
-            }
+            cv::Size carved = CarvedSize();
+            int remaining = mDirection == SeamDirection::VERTICAL ? carved.width - mSize.width : carved.height - mSize.height;
+            if (remaining > 0)
+                FindSeams(mDirection, remaining);
             else
-            {
-                FindHorizontalSeam(seam);
+                InsertSeams(mDirection, -remaining);
+        }
+        mRecordSequence = false;
+        SetWorkingDirection(SeamDirection::VERTICAL);
+        // the result leaves the workspace, which the next image reuses
+        cv::Mat output;
+        mCarvedImage.convertTo(output, CV_8UC3);
+        mCarvedImage = output;
+        if (mDebugCallback) mDebugCallback("carved", mCarvedImage);
+    }
+}
+
+void SeamCarver::PrecomputeSeamOrder(const cv::Mat &input) noexcept
+{
+    mOriginImage = input.clone();
+    mBudgetExceeded = false;
+    CalcSeamOrder(mOriginImage, SeamDirection::VERTICAL);
+    CalcSeamOrder(mOriginImage, SeamDirection::HORIZONTAL);
+}
+
+cv::Mat SeamCarver::Retarget(cv::Size size) const noexcept
+{
+    cv::Mat output;
+    if (HasSeamOrder() && !size.empty())
+    {
+        const int rows = mOriginImage.rows;
+        const int cols = mOriginImage.cols;
+        const size_t elemSize = mOriginImage.elemSize();
+        cv::Mat carved;
+
+        // carve the side that is too long for the aspect ratio of the target, then scale to the target
+        double h1 = cols * (size.height / (double)size.width);
+        if (h1 < rows)
+        {
+            // a pixel survives if it is removed after the first n seams, that leaves `keep` pixels in every column
+            const int keep = std::max(1, cvRound(h1));
+            const int n = rows - keep;
+            carved.create(keep, cols, mOriginImage.type());
+            std::vector<int> count(cols, 0);
+            for (int i = 0; i < rows; i++) {
+                const int* order = mHorizontalOrder.ptr<int>(i);
+                const uchar* src = mOriginImage.ptr<uchar>(i);
+                for (int j = 0; j < cols; j++) {
+                    if (order[j] >= n) {
+                        std::memcpy(carved.ptr<uchar>(count[j]++) + j * elemSize, src + j * elemSize, elemSize);
+                    }
+                }
+            }
+        }
+        else
+        {
+            const int keep = std::clamp(cvRound(rows * (size.width / (double)size.height)), 1, cols);
+            const int n = cols - keep;
+            carved.create(rows, keep, mOriginImage.type());
+            for (int i = 0; i < rows; i++) {
+                const int* order = mVerticalOrder.ptr<int>(i);
+                const uchar* src = mOriginImage.ptr<uchar>(i);
+                uchar* dst = carved.ptr<uchar>(i);
+                for (int j = 0; j < cols; j++) {
+                    if (order[j] >= n) {
+                        std::memcpy(dst, src + j * elemSize, elemSize);
+                        dst += elemSize;
+                    }
+                }
             }
         }
-        mCarvedImage.convertTo(mCarvedImage, CV_8UC3);
-        cv::namedWindow("debug mCarvedImage", cv::WINDOW_FREERATIO); cv::imshow("debug mCarvedImage", mCarvedImage);
+        cv::resize(carved, output, size, 0, 0, cv::INTER_CUBIC);
     }
+    return output;
+}
+
+void SeamCarver::CalcSeamOrder(const cv::Mat &image, SeamDirection direction) noexcept
+{
+    const bool vertical = direction == SeamDirection::VERTICAL;
+    cv::Mat protectionMask = mProtectionMask;
+    cv::Mat& order = vertical ? mVerticalOrder : mHorizontalOrder;
+
+    // carve down to a single line, CarveSeams writes the seam number of every removed pixel into `order`
+    // through mIndexMap, which follows the carved image and holds the original index of each pixel
+    order.create(image.size(), CV_32SC1);
+    order.setTo(cv::Scalar(std::numeric_limits<int>::max()));
+    mIndexMap.create(image.size(), CV_32SC1);
+    for (int i = 0; i < image.rows; i++) {
+        int* index = mIndexMap.ptr<int>(i);
+        for (int j = 0; j < image.cols; j++) {
+            index[j] = i * image.cols + j;
+        }
+    }
+    mCarvedImage = image.clone();
+    if (!protectionMask.empty()) mProtectionMask = protectionMask.clone();
+    mEnergyMap.release();
+    mDPValid = false;
+    mSpansValid = false;
+    mTransposed = false;
+    mSeamCount = 0;
+    while ((vertical ? CarvedSize().width : CarvedSize().height) > 1)
+    {
+        FindSeams(direction, (vertical ? CarvedSize().width : CarvedSize().height) - 1);
+    }
+
+    mIndexMap.release();
+    mCarvedImage.release();
+    mEnergyMap.release();
+    mGrayImage.release();
+    mProtectionMask = protectionMask;
+    mDPValid = false;
+    mSpansValid = false;
+    mTransposed = false;
 }
 
 void SeamCarver::CalcEnergyMap() noexcept
 {
-    cv::Mat grayImage, sobelMapX, sobelMapY;
-    cv::cvtColor(mCarvedImage, grayImage, cv::COLOR_RGB2GRAY);
+    // gray, energy and sobel responses are workspace views: no allocation unless the image is the largest so far
+    mGrayImage = WorkspaceView(mGrayBuffer, mCarvedImage.size(), CV_8U);
+    cv::cvtColor(mCarvedImage, mGrayImage, cv::COLOR_RGB2GRAY);
+
+    // integer from the gray image to the dp: 16-bit sobel responses, each clamped to 255 like
+    // convertScaleAbs, averaged and summed with the masks into the uint16 energy in one pass.
+    // Forward energy has its gradients in the dp (RelaxSeamRowForward), the map only holds the masks
+    const bool forward = mEnergyType == SeamEnergyType::FORWARD_ENERGY;
+    mEnergyMap = WorkspaceView(mEnergyBuffer, mGrayImage.size(), CV_16U);
+    const bool protection = !mProtectionMask.empty();
+    const bool removal = !mRemovalMask.empty();
+
+    // under a scratch budget the sobel responses are computed in strips of rows, each with a halo of the
+    // kernel radius above and below so that the rows of the strip get the same values as a full pass
+    const int rows = mEnergyMap.rows;
+    const int halo = std::max(1, mKernelSize / 2);
+    const size_t resident = ResidentBytes() - BufferBytes(mSobelBuffers[0]) - BufferBytes(mSobelBuffers[1]);
+    const int strip = std::max(energyMinStripRows, BudgetRows(size_t(mEnergyMap.cols) * 2 * sizeof(short), rows, resident));
+    for (int top = 0; top < rows; top += strip) {
+        const int bottom = std::min(rows, top + strip);
+        const int first = std::max(0, top - halo);
+        cv::Mat sobelMapX, sobelMapY;
+        if (!forward)
+        {
+            const cv::Mat gray = mGrayImage.rowRange(first, std::min(rows, bottom + halo));
+            sobelMapX = WorkspaceView(mSobelBuffers[0], gray.size(), CV_16S);
+            sobelMapY = WorkspaceView(mSobelBuffers[1], gray.size(), CV_16S);
+            cv::Sobel(gray, sobelMapX, CV_16S, 1, 0, mKernelSize);
+            cv::Sobel(gray, sobelMapY, CV_16S, 0, 1, mKernelSize);
+        }
+        for (int i = top; i < bottom; i++) {
+            const short* gradX = forward ? nullptr : sobelMapX.ptr<short>(i - first);
+            const short* gradY = forward ? nullptr : sobelMapY.ptr<short>(i - first);
+            const uchar* mask = protection ? mProtectionMask.ptr<uchar>(i) : nullptr;
+            const uchar* removalMask = removal ? mRemovalMask.ptr<uchar>(i) : nullptr;
+            ushort* energy = mEnergyMap.ptr<ushort>(i);
+            for (int j = 0; j < mEnergyMap.cols; j++) {
+                int value = forward ? 0 : (std::min(std::abs(int(gradX[j])), 255) + std::min(std::abs(int(gradY[j])), 255) + 1) >> 1;
+                value += protection ? mask[j] : 0;
+                if (removal) value = removalMask[j] ? 0 : value + removalBias;
+                energy[j] = static_cast<ushort>(value);
+            }
+        }
+    }
+    if (mDebugCallback) mDebugCallback("energy", mEnergyMap);
 
-    cv::Sobel(grayImage, sobelMapX, CV_32F, 1, 0, mKernelSize);
-    cv::convertScaleAbs(sobelMapX, sobelMapX);
+    if (mDerivKernelSize != mKernelSize)
+    {
+        cv::Mat derivKernel, smoothKernel;
+        cv::getDerivKernels(derivKernel, smoothKernel, 1, 0, mKernelSize, false, CV_32F);
+        mDerivKernel.assign(derivKernel.ptr<float>(0), derivKernel.ptr<float>(0) + derivKernel.total());
+        mSmoothKernel.assign(smoothKernel.ptr<float>(0), smoothKernel.ptr<float>(0) + smoothKernel.total());
+        mDerivKernelSize = mKernelSize;
+    }
+}
 
-    cv::Sobel(grayImage, sobelMapY, CV_32F, 0, 1, mKernelSize);
-    cv::convertScaleAbs(sobelMapY, sobelMapY);
-    cv::Mat energyImage;
-    cv::addWeighted(sobelMapX, 0.5, sobelMapY, 0.5, 0, energyImage);
-    cv::Mat im_color;  
-    cv::applyColorMap(energyImage, im_color, cv::COLORMAP_JET);
+uint16_t SeamCarver::CalcEnergyAt(int x, int y) const noexcept
+{
+    // same value CalcEnergyMap produces for this pixel: the sobel kernels are separable,
+    // d/dx is mDerivKernel along x and mSmoothKernel along y, d/dy the other way around
+    const int derivRadius = static_cast<int>(mDerivKernel.size()) / 2;
+    const int smoothRadius = static_cast<int>(mSmoothKernel.size()) / 2;
+    int gradX = 0;
+    int gradY = 0;
+    for (int a = 0; a < static_cast<int>(mSmoothKernel.size()); ++a) {
+        const uchar* row = mGrayImage.ptr<uchar>(cv::borderInterpolate(y + a - smoothRadius, mGrayImage.rows, cv::BORDER_REFLECT_101));
+        int sum = 0;
+        for (int b = 0; b < static_cast<int>(mDerivKernel.size()); ++b) {
+            sum += mDerivKernel[b] * row[cv::borderInterpolate(x + b - derivRadius, mGrayImage.cols, cv::BORDER_REFLECT_101)];
+        }
+        gradX += mSmoothKernel[a] * sum;
+    }
+    for (int a = 0; a < static_cast<int>(mDerivKernel.size()); ++a) {
+        const uchar* row = mGrayImage.ptr<uchar>(cv::borderInterpolate(y + a - derivRadius, mGrayImage.rows, cv::BORDER_REFLECT_101));
+        int sum = 0;
+        for (int b = 0; b < static_cast<int>(mSmoothKernel.size()); ++b) {
+            sum += mSmoothKernel[b] * row[cv::borderInterpolate(x + b - smoothRadius, mGrayImage.cols, cv::BORDER_REFLECT_101)];
+        }
+        gradY += mDerivKernel[a] * sum;
+    }
 
-    cv::namedWindow("debug eneryMap", cv::WINDOW_FREERATIO);
-    cv::imshow("debug eneryMap",im_color);
+    int energy = (std::min(std::abs(gradX), 255) + std::min(std::abs(gradY), 255) + 1) >> 1;
     if (!mProtectionMask.empty())
     {
-        cv::add(energyImage, mProtectionMask, mEnergyMap);
+        energy += mProtectionMask.at<uchar>(y, x);
+    }
+    if (!mRemovalMask.empty())
+    {
+        energy = mRemovalMask.at<uchar>(y, x) ? 0 : energy + removalBias;
     }
-    mEnergyMap.convertTo(mEnergyMap, CV_32F);
-    grayImage.release();
-    sobelMapX.release();
-    sobelMapY.release();
+    return static_cast<uint16_t>(energy);
+}
+
+void SeamCarver::UpdateEnergyMap(const std::vector<int> &seam) noexcept
+{
+    // CarveSeams already took the seam out of mGrayImage and mEnergyMap together with the image
+    if (mEnergyMap.empty() || mGrayImage.size() != mEnergyMap.size() || seam.size() != static_cast<size_t>(mGrayImage.rows))
+    {
+        return;
+    }
+
+    // a pixel keeps its energy unless its sobel window overlaps the seam in one of the rows it covers,
+    // so only a band of radius + 1 around the seam positions of the neighbouring rows is recomputed.
+    // Forward energy has no window, but the band still tells UpdateDynamicProgramming which cells got
+    // new gray neighbours: the two next to the seam and those between the seam positions of two rows
+    const bool forward = mEnergyType == SeamEnergyType::FORWARD_ENERGY;
+    const int radius = forward ? 1 : static_cast<int>(std::max(mDerivKernel.size(), mSmoothKernel.size())) / 2;
+    const int rows = mEnergyMap.rows;
+    const int cols = mEnergyMap.cols;
+    const bool barriers = HasBarriers(mEnergyMap);
+    mEnergyBand.resize(rows);
+    for (int y = 0; y < rows; ++y) {
+        int low = seam[y];
+        int high = seam[y];
+        for (int i = std::max(0, y - radius); i <= std::min(rows - 1, y + radius); ++i) {
+            low = std::min(low, seam[i]);
+            high = std::max(high, seam[i]);
+        }
+        mEnergyBand[y] = cv::Range(std::max(0, low - radius - 1), std::min(cols, high + radius + 1));
+        if (forward) {
+            continue;
+        }
+        // the energy under a barrier of the restricted search is never read
+        uint16_t* energy = mEnergyMap.ptr<uint16_t>(y);
+        const int spanEnd = barriers ? mSpanIndex[y + 1] : 0;
+        int span = barriers ? mSpanIndex[y] : 0;
+        for (int x = mEnergyBand[y].start; x < mEnergyBand[y].end; ++x) {
+            while (span < spanEnd && mSpans[span].end <= x) ++span;
+            if (span < spanEnd && mSpans[span].start <= x) {
+                x = mSpans[span].end - 1;
+                continue;
+            }
+            energy[x] = CalcEnergyAt(x, y);
+        }
+    }
+}
+
+void SeamCarver::BuildProtectedSpans() noexcept
+{
+    // runs of protected pixels of every row; a row protected from end to end gets none, a seam has to cross it
+    mSpans.clear();
+    mSpanIndex.assign(mCarvedImage.rows + 1, 0);
+    mSpanSize = mCarvedImage.size();
+    mSpansValid = true;
+    if (!mRestrictedSearch || mProtectionMask.size() != mCarvedImage.size())
+    {
+        return;
+    }
+    for (int i = 0; i < mProtectionMask.rows; i++) {
+        const uchar* mask = mProtectionMask.ptr<uchar>(i);
+        const size_t first = mSpans.size();
+        int covered = 0;
+        for (int j = 0; j < mProtectionMask.cols;) {
+            if (mask[j] < protectedLevel) {
+                ++j;
+                continue;
+            }
+            const int start = j;
+            while (j < mProtectionMask.cols && mask[j] >= protectedLevel) ++j;
+            mSpans.emplace_back(start, j);
+            covered += j - start;
+        }
+        if (covered == mProtectionMask.cols) {
+            mSpans.resize(first);
+        }
+        mSpanIndex[i + 1] = static_cast<int>(mSpans.size());
+    }
+}
+
+void SeamCarver::CarveProtectedSpans(const std::vector<int> &seams, int count) noexcept
+{
+    // a span moves left by the seams before it; seams only cross it when no way around was left
+    if (!mSpansValid || mSpanSize != mCarvedImage.size())
+    {
+        mSpansValid = false;
+        return;
+    }
+    const int rows = mSpanSize.height;
+    for (int j = 0; j < rows; j++) {
+        for (int s = mSpanIndex[j]; s < mSpanIndex[j + 1]; s++) {
+            int before = 0;
+            int inside = 0;
+            for (int k = 0; k < count; k++) {
+                const int seam = seams[size_t(k) * rows + j];
+                before += seam < mSpans[s].start;
+                inside += seam >= mSpans[s].start && seam < mSpans[s].end;
+            }
+            mSpans[s].start -= before;
+            mSpans[s].end -= before + inside;
+        }
+    }
+    mSpanSize.width -= count;
+}
+
+bool SeamCarver::HasBarriers(const cv::Mat& energy_map) const noexcept
+{
+    // pyramid levels and removal bands have other coordinates than the spans
+    return mSpansValid && !mSpans.empty() && energy_map.size() == mSpanSize;
 }
 
 cv::Mat SeamCarver::CalcCarvedImage(const cv::Mat &image, cv::Size size) noexcept
 {
-    cv::Mat output;
-    
-    if(!image.empty() && !size.empty())
+    if (image.empty() || size.empty())
+    {
+        return {};
+    }
+
+    cv::Size scaled;
+    int interpolation = cv::INTER_CUBIC;
+    if (mOptimalOrder && image.cols > size.width && image.rows > size.height)
+    {
+        // both sides are carved: scale down only as far as it takes to keep the transport map small
+        double cover = std::max(size.width / (double)image.cols, size.height / (double)image.rows);
+        double steps = std::min((size.width + transportMaxSteps) / (double)image.cols, (size.height + transportMaxSteps) / (double)image.rows);
+        double scale = std::min(1.0, std::max(cover, steps));
+        scaled = cv::Size(std::max(size.width, cvRound(image.cols * scale)), std::max(size.height, cvRound(image.rows * scale)));
+        interpolation = cv::INTER_AREA;
+    }
+    else
     {
         double h1 = size.width * (image.rows / (double)image.cols);
         double w2 = size.height * (image.cols / (double)image.rows);
-        if (h1 > size.height)
+        // scale until one side matches: the other one is then carved down to the target,
+        // or with seam insertion scaled below the target and enlarged by inserting seams. That side keeps
+        // at least two pixels, seam insertion needs a neighbour and resize an image
+        if ((h1 > size.height) != mSeamInsertion)
+            scaled = cv::Size(size.width, std::max(2, static_cast<int>(h1)));
+        else
+            scaled = cv::Size(std::max(2, static_cast<int>(w2)), size.height);
+    }
+
+    // the scaled image and masks are views into the map buffers: no allocation once they are large enough,
+    // and the masks of the caller are left as they are
+    cv::Mat output = MapBuffer(0, scaled, image.type(), image);
+    cv::resize(image, output, scaled, 0, 0, interpolation);
+    if (!mProtectionMask.empty())
+    {
+        cv::Mat mask = MapBuffer(1, scaled, mProtectionMask.type(), mProtectionMask);
+        cv::resize(mProtectionMask, mask, scaled, 0, 0, interpolation);
+        mProtectionMask = mask;
+    }
+    if (!mRemovalMask.empty())
+    {
+        cv::Mat mask = MapBuffer(2, scaled, mRemovalMask.type(), mRemovalMask);
+        cv::resize(mRemovalMask, mask, scaled, 0, 0, cv::INTER_NEAREST);
+        mRemovalMask = mask;
+    }
+    return output;
+}
+
+void SeamCarver::FindSeams(SeamDirection direction, int remaining) noexcept
+{
+    // all seams are carved as vertical seams of the working maps
+    SetWorkingDirection(direction);
+
+    // UpdateEnergyMap keeps the map in sync after single seams, batches need a full pass
+    if (!mIncrementalEnergy || mEnergyMap.size() != mCarvedImage.size())
+    {
+        CalcEnergyMap();
+    }
+
+    if (mPyramidLevels > 0)
+    {
+        FindPyramidSeams(std::clamp(remaining, 1, std::max(mBatchSize, 1)));
+    }
+    else if (mBatchSize > 1 && remaining > 1)
+    {
+        FindSeamBatch(std::min(mBatchSize, remaining));
+    }
+    else
+    {
+        FindVerticalSeam(&mSeam);
+    }
+}
+
+void SeamCarver::SetWorkingDirection(SeamDirection direction) noexcept
+{
+    // horizontal seams are vertical seams of the transposed image: the working maps are transposed once
+    // per direction change instead of walking columns. The sobel energy is symmetric under transposition,
+    // so the energy map stays valid, only the dp table has to be rebuilt. Each map goes to the other buffer
+    // of its pair, so the transposes are allocation free once the buffers are large enough
+    const bool transposed = direction == SeamDirection::HORIZONTAL;
+    if (transposed != mTransposed)
+    {
+        cv::Mat* maps[] = { &mCarvedImage, &mProtectionMask, &mRemovalMask, &mIndexMap, &mGrayImage, &mEnergyMap };
+        for (int i = 0; i < static_cast<int>(std::size(maps)); i++) {
+            if (!maps[i]->empty()) {
+                cv::Mat map = MapBuffer(i, cv::Size(maps[i]->rows, maps[i]->cols), maps[i]->type(), *maps[i]);
+                cv::transpose(*maps[i], map);
+                *maps[i] = map;
+            }
+        }
+        mTransposed = transposed;
+        mDPValid = false;
+        mSpansValid = false;
+    }
+}
+
+cv::Size SeamCarver::CarvedSize() const noexcept
+{
+    return mTransposed ? cv::Size(mCarvedImage.rows, mCarvedImage.cols) : mCarvedImage.size();
+}
+
+size_t SeamCarver::ResidentBytes() const noexcept
+{
+    // the workspace buffers and dp tables at their capacity, and the maps outside of them. Carved maps are
+    // views into the buffers they started with, their full rows are counted
+    auto buffers = [this](auto&& visit) {
+        visit(mGrayBuffer);
+        visit(mEnergyBuffer);
+        for (const cv::Mat& buffer : mMapBuffers) visit(buffer);
+        for (const cv::Mat& buffer : mSobelBuffers) visit(buffer);
+        for (const cv::Mat& buffer : mPyramidBuffers) visit(buffer);
+        for (const cv::Mat& buffer : mStepBuffers) visit(buffer);
+    };
+    size_t bytes = (mCostMap.capacity() + mCostLine.capacity() + mTileCost.capacity() + mCheckpoints.capacity() + mReplayCost.capacity()) * sizeof(int32_t);
+    bytes += (mParentMap.capacity() + mTileParent.capacity()) * sizeof(int8_t) + mSeamMask.capacity() + mSeamTaken.capacity() * sizeof(int);
+    buffers([&bytes](const cv::Mat& buffer) { bytes += BufferBytes(buffer); });
+    const cv::Mat* maps[] = { &mCarvedImage, &mGrayImage, &mEnergyMap, &mProtectionMask, &mRemovalMask, &mIndexMap,
+                              &mOriginImage, &mVerticalOrder, &mHorizontalOrder, &mSequenceGray, &mSequenceNext };
+    for (const cv::Mat* map : maps) {
+        bool workspace = false;
+        buffers([map, &workspace](const cv::Mat& buffer) { workspace |= InBuffer(*map, buffer); });
+        if (!workspace) {
+            bytes += map->step * size_t(map->rows);
+        }
+    }
+    return bytes;
+}
+
+int SeamCarver::BudgetRows(size_t row_bytes, int rows, size_t resident) noexcept
+{
+    // rows of a temporary buffer that fit into the scratch budget next to the resident maps
+    if (mScratchBudget == 0)
+    {
+        return rows;
+    }
+    mBudgetExceeded |= resident >= mScratchBudget;
+    const size_t available = mScratchBudget > resident ? mScratchBudget - resident : 0;
+    return static_cast<int>(std::min<size_t>(rows, available / std::max<size_t>(row_bytes, 1)));
+}
+
+void SeamCarver::ResizeDynamicProgramming(int length, int width) noexcept
+{
+    // resize() keeps the capacity, so buffers are only allocated while the image grows. When the table does
+    // not fit into the scratch budget, only the cost rows of one band of the parallel dp are kept: the
+    // backtrack needs the parents and the last row, but the table can't be updated in place. When the
+    // parents don't fit either they are streamed: a ring of mParentRows rows and the cost row at the start of
+    // each segment of as many rows, from which the backtrack replays the parents of a segment (ReplayParents)
+    const int stride = width + 2;
+    const size_t resident = ResidentBytes() - (mCostMap.capacity() + mCheckpoints.capacity() + mReplayCost.capacity()) * sizeof(int32_t) - mParentMap.capacity() * sizeof(int8_t);
+    const bool table = BudgetRows(size_t(stride) * (sizeof(int32_t) + sizeof(int8_t)), length, resident) == length;
+    mCostRows = table ? length : std::min(length, dpBandRows + 1);
+    const size_t costBytes = size_t(mCostRows) * stride * sizeof(int32_t);
+    const bool parents = table || BudgetRows(size_t(stride) * sizeof(int8_t), length, resident + costBytes) == length;
+    // segments of about 2 sqrt(length) rows take the least memory, ring and saved rows, and at least one band
+    mParentRows = parents ? length : std::min(length, std::max(dpBandRows, static_cast<int>(2 * std::sqrt(double(length)))));
+    const bool streamed = mParentRows < length;
+    mCostMap.resize(size_t(mCostRows) * stride);
+    mParentMap.resize(size_t(mParentRows) * stride);
+    mCheckpoints.resize(streamed ? size_t((length - 1) / mParentRows + 1) * stride : 0);
+    mReplayCost.resize(streamed ? size_t(2) * stride : 0);
+    if (!table && mCostMap.capacity() > 2 * mCostMap.size())
+    {
+        mCostMap.shrink_to_fit();
+    }
+    if (streamed && mParentMap.capacity() > 2 * mParentMap.size())
+    {
+        mParentMap.shrink_to_fit();
+    }
+    mDPStride = stride;
+    mDPLength = length;
+    mDPWidth = width;
+    // the forward pass leaves the parents of the last segment in the ring
+    mParentSegment = std::max(0, length - 2) / mParentRows;
+}
+
+void SeamCarver::SaveCheckpoint(int row) noexcept
+{
+    // the cost row at the start of a segment of a streamed table, sentinels included
+    if (mParentRows < mDPLength && row % mParentRows == 0)
+    {
+        const int32_t* cost = CostRow(row) - 1;
+        std::copy(cost, cost + mDPStride, &mCheckpoints[size_t(row / mParentRows) * mDPStride]);
+    }
+}
+
+template <typename Relax>
+void SeamCarver::ReplayParents(int row, Relax relax) noexcept
+{
+    // makes the ring hold the parents of the row. Segment s covers the rows s * mParentRows + 1 to
+    // (s + 1) * mParentRows, it is relaxed again from the saved cost row s * mParentRows in two rows of its own
+    const int segment = (row - 1) / mParentRows;
+    if (segment == mParentSegment)
+    {
+        return;
+    }
+    const int first = segment * mParentRows;
+    const int last = std::min(first + mParentRows, mDPLength - 1);
+    const int32_t* checkpoint = &mCheckpoints[size_t(first / mParentRows) * mDPStride];
+    int32_t* rows[2] = { &mReplayCost[1], &mReplayCost[mDPStride + 1] };
+    std::copy(checkpoint, checkpoint + mDPStride, rows[0] - 1);
+    std::copy(checkpoint, checkpoint + mDPStride, rows[1] - 1);
+    for (int j = first + 1; j <= last; ++j) {
+        relax(j, rows[(j - first - 1) & 1], rows[(j - first) & 1], ParentRow(j));
+    }
+    mParentSegment = segment;
+}
+
+template <typename Relax>
+void SeamCarver::BacktrackPath(int seam_idx, std::vector<int>* seam, Relax relax) noexcept
+{
+    // from an end cell up the parents, relax recomputes a row of a streamed table
+    seam->resize(mDPLength);
+    for (int j = mDPLength - 1; j >= 0; --j) {
+        (*seam)[j] = seam_idx;
+        if (j > 0) {
+            ReplayParents(j, relax);
+            seam_idx += ParentRow(j)[seam_idx];
+        }
+    }
+}
+
+void SeamCarver::FindVerticalSeam(std::vector<int> *seam) noexcept
+{
+    // the table left by the previous vertical seam is already up to date, only the backtrack is needed
+    if (mIncrementalDP && mDPValid && mDPLength == mEnergyMap.rows && mDPWidth == mEnergyMap.cols)
+    {
+        BacktrackSeam(mEnergyMap, seam, mEnergyType);
+    }
+    else
+    {
+        CalcDynamicProgramming(mEnergyMap, seam, mEnergyType);
+    }
+    CarveSeams(*seam, 1);
+    mDPValid = false;
+    if (mIncrementalEnergy)
+    {
+        UpdateEnergyMap(*seam);
+        if (mIncrementalDP)
+        {
+            UpdateDynamicProgramming(mEnergyMap, *seam, mEnergyType);
+        }
+    }
+}
+
+void SeamCarver::FindSeamBatch(int count) noexcept
+{
+    // one dp pass for the whole batch, the seams after the first are slightly worse than carving them one by one
+    CalcDynamicProgramming(mEnergyMap, &mSeam, mEnergyType);
+    int found = BacktrackSeams(mEnergyMap, count, &mSeams, mEnergyType);
+    CarveSeams(mSeams, found);
+    mEnergyMap.release();
+    mDPValid = false;
+}
+
+void SeamCarver::FindPyramidSeams(int count) noexcept
+{
+    // seams are searched on a downscaled energy map, each level halves both sides
+    const bool forward = mEnergyType == SeamEnergyType::FORWARD_ENERGY;
+    mPyramidEnergy = mEnergyMap;
+    if (forward) mDPGray = mGrayImage;
+    int scale = 1;
+    for (int level = 0; level < mPyramidLevels && std::min(mPyramidEnergy.cols, mPyramidEnergy.rows) >= 8; ++level) {
+        // the levels take turns in two workspace buffers per map
+        const cv::Size half((mPyramidEnergy.cols + 1) / 2, (mPyramidEnergy.rows + 1) / 2);
+        cv::Mat energy = WorkspaceView(mPyramidBuffers[level & 1], half, CV_16U);
+        cv::pyrDown(mPyramidEnergy, energy, half);
+        mPyramidEnergy = energy;
+        if (forward)
         {
-            cv::resize(image, output, cv::Size(size.width, h1), 0, 0, cv::INTER_CUBIC);
-            if(!mProtectionMask.empty()) cv::resize(mProtectionMask, mProtectionMask, cv::Size(size.width, h1), 0, 0, cv::INTER_CUBIC);
+            cv::Mat gray = WorkspaceView(mPyramidBuffers[2 + (level & 1)], half, CV_8U);
+            cv::pyrDown(mDPGray, gray, half);
+            mDPGray = gray;
         }
+        scale *= 2;
+    }
+    if (scale == 1)
+    {
+        // too small for a pyramid, carve at full resolution
+        FindVerticalSeam(&mSeam);
+        return;
+    }
+
+    CalcDynamicProgramming(mPyramidEnergy, &mSeam, mEnergyType);
+    const int coarseLength = mDPLength;
+    const int found = BacktrackSeams(mPyramidEnergy, count, &mCoarseSeams, mEnergyType);
+
+    // the seams of a batch never cross, going from right to left keeps the positions of the remaining
+    // ones valid after each removal
+    mSeamOrder.resize(found);
+    for (int k = 0; k < found; ++k) {
+        mSeamOrder[k] = k;
+    }
+    std::sort(mSeamOrder.begin(), mSeamOrder.end(), [this, coarseLength](int a, int b) {
+        return mCoarseSeams[size_t(a) * coarseLength] > mCoarseSeams[size_t(b) * coarseLength];
+    });
+
+    for (int k = 0; k < found; ++k) {
+        const int* coarse = &mCoarseSeams[size_t(mSeamOrder[k]) * coarseLength];
+        RefineSeam(mEnergyMap, coarse, coarseLength, scale, scale, &mSeam, mEnergyType);
+        CarveSeams(mSeam, 1);
+        if (mIncrementalEnergy)
+            UpdateEnergyMap(mSeam);
         else
+            CalcEnergyMap();
+    }
+    mDPValid = false;
+}
+
+void SeamCarver::RemoveObject() noexcept
+{
+    // masked pixels have the lowest energy (CalcEnergyMap), seams are searched within the columns of the
+    // mask plus removalSlack and carved across the short side of the mask until no masked pixel is left
+    cv::Rect box = cv::boundingRect(mRemovalMask);
+    mRemovalArea = cv::countNonZero(mRemovalMask);
+    if (mRemovalArea == 0)
+    {
+        mRemovalMask.release();
+        return;
+    }
+    const bool vertical = box.width <= box.height;
+    SetWorkingDirection(vertical ? SeamDirection::VERTICAL : SeamDirection::HORIZONTAL);
+    int begin = vertical ? box.x : box.y;
+    int end = begin + (vertical ? box.width : box.height);
+    // the mask has the lowest energy, a maximum search would go around it
+    const SeamEnergyType removalType = mEnergyType == SeamEnergyType::MAX_ENERGY ? SeamEnergyType::MIN_ENERGY : mEnergyType;
+    CalcEnergyMap();
+
+    // the masked columns only move left, every seam takes one of them away
+    while (mRemovalArea > 0 && mCarvedImage.cols > 1)
+    {
+        const int first = std::max(0, begin - removalSlack);
+        const int last = std::min(mCarvedImage.cols, end + removalSlack);
+        mDPGray = mGrayImage.colRange(first, last);
+        CalcDynamicProgramming(mEnergyMap.colRange(first, last), &mSeam, removalType);
+        int removed = 0;
+        for (int j = 0; j < mCarvedImage.rows; j++) {
+            mSeam[j] += first;
+            removed += mRemovalMask.at<uchar>(j, mSeam[j]) != 0;
+        }
+        if (removed == 0)
         {
-            cv::resize(image, output, cv::Size(w2, size.height), 0, 0, cv::INTER_CUBIC);
-            if(!mProtectionMask.empty()) cv::resize(mProtectionMask, mProtectionMask, cv::Size(w2, size.height), 0, 0, cv::INTER_CUBIC);
+            break;
         }
+        CarveSeams(mSeam, 1);
+        mRemovalArea -= removed;
+        end = std::max(begin + 1, end - 1);
+        if (mIncrementalEnergy)
+            UpdateEnergyMap(mSeam);
+        else
+            CalcEnergyMap();
     }
-    else
+
+    // without the mask the energy loses its bias, it is recomputed by the next search
+    mRemovalMask.release();
+    mEnergyMap.release();
+    mDPGray.release();
+    mDPValid = false;
+}
+
+bool SeamCarver::MatchesSequence(const cv::Mat &input) noexcept
+{
+    // a frame continues the sequence if it has the size and target of the previous one, and its scaled
+    // image differs from the previous one by at most sequenceMaxDifference gray levels per pixel on average
+    cv::Mat& gray = mSequenceNext;
+    cv::cvtColor(mCarvedImage, gray, cv::COLOR_RGB2GRAY);
+    bool match = !mSequenceSteps.empty() && input.size() == mSequenceInput && mSize == mSequenceSize && gray.size() == mSequenceGray.size();
+    if (match)
     {
-        output = {};
+        int64_t difference = 0;
+        for (int i = 0; i < gray.rows; i++) {
+            const uchar* current = gray.ptr<uchar>(i);
+            const uchar* previous = mSequenceGray.ptr<uchar>(i);
+            for (int j = 0; j < gray.cols; j++) {
+                difference += std::abs(current[j] - previous[j]);
+            }
+        }
+        match = difference <= int64_t(sequenceMaxDifference) * gray.rows * gray.cols;
     }
+    std::swap(mSequenceGray, mSequenceNext);
+    mSequenceInput = input.size();
+    mSequenceSize = mSize;
+    return match;
+}
 
-    return output;
+void SeamCarver::RecordSequenceStep(const std::vector<int> &seams, int count, bool insert) noexcept
+{
+    // a carved batch is kept as single seams removed one after the other: in every row a seam moves left by
+    // the seams of the batch before it that lie to its left. Inserted seams stay a batch, they are duplicated together
+    const int rows = mCarvedImage.rows;
+    const size_t offset = mSequenceSeams.size();
+    mSequenceSeams.insert(mSequenceSeams.end(), seams.begin(), seams.begin() + size_t(count) * rows);
+    mSequenceSteps.push_back({ mTransposed, insert, count });
+    if (insert)
+    {
+        return;
+    }
+    for (int k = 1; k < count; k++) {
+        for (int j = 0; j < rows; j++) {
+            int before = 0;
+            for (int m = 0; m < k; m++) {
+                before += seams[size_t(m) * rows + j] < seams[size_t(k) * rows + j];
+            }
+            mSequenceSeams[offset + size_t(k) * rows + j] -= before;
+        }
+    }
 }
 
-void SeamCarver::FindHorizontalSeam(std::vector<int> *seam) noexcept
+void SeamCarver::CarveSequenceFrame() noexcept
 {
-    CalcDynamicProgramming(mEnergyMap, seam, SeamDirection::HORIZONTAL, SeamEnergyType::MIN_ENERGY);
-    RemoveSeam(mCarvedImage, *seam, SeamDirection::HORIZONTAL);
-    RemoveSeam(mProtectionMask, *seam, SeamDirection::HORIZONTAL);
+    // the steps of the previous frame in the same order, each seam searched within sequenceBand pixels of
+    // where it was: a band dp instead of the whole table, and seams that move smoothly from frame to frame
+    size_t offset = 0;
+    for (const SequenceStep& step : mSequenceSteps) {
+        SetWorkingDirection(step.horizontal ? SeamDirection::HORIZONTAL : SeamDirection::VERTICAL);
+        if (!mIncrementalEnergy || mEnergyMap.size() != mCarvedImage.size())
+        {
+            CalcEnergyMap();
+        }
+        const int length = mCarvedImage.rows;
+        for (int k = 0; k < step.count; k++) {
+            int* previous = &mSequenceSeams[offset + size_t(k) * length];
+            RefineSeam(mEnergyMap, previous, length, 1, sequenceBand, &mSeam, mEnergyType);
+            std::copy(mSeam.begin(), mSeam.end(), previous);
+            if (step.insert)
+            {
+                continue;
+            }
+            CarveSeams(mSeam, 1);
+            if (mIncrementalEnergy)
+                UpdateEnergyMap(mSeam);
+            else
+                CalcEnergyMap();
+        }
+        if (step.insert)
+        {
+            // the seams of an insertion are searched on the same energy, then duplicated together
+            mSeams.assign(mSequenceSeams.begin() + offset, mSequenceSeams.begin() + offset + size_t(step.count) * length);
+            DuplicateSeams(mSeams, step.count);
+            mEnergyMap.release();
+            mGrayImage.release();
+        }
+        offset += size_t(step.count) * length;
+    }
+    mDPValid = false;
 }
 
-void SeamCarver::FindVerticalSeam(std::vector<int> *seam) noexcept
+void SeamCarver::InsertSeams(SeamDirection direction, int count) noexcept
 {
-    CalcDynamicProgramming(mEnergyMap, seam, SeamDirection::VERTICAL, SeamEnergyType::MIN_ENERGY);
-    RemoveSeam(mCarvedImage, *seam, SeamDirection::VERTICAL);
-    RemoveSeam(mProtectionMask, *seam, SeamDirection::VERTICAL);
+    // the k best seams of one dp pass are duplicated together. Inserting them one by one would find the
+    // same seam again every time; more than half the width per pass stretches the same low energy areas
+    SetWorkingDirection(direction);
+    CalcEnergyMap();
+    count = std::clamp(count, 1, std::max(1, mCarvedImage.cols / 2));
+    CalcDynamicProgramming(mEnergyMap, &mSeam, mEnergyType);
+    int found = BacktrackSeams(mEnergyMap, count, &mSeams, mEnergyType);
+    DuplicateSeams(mSeams, found);
+    mEnergyMap.release();
+    mGrayImage.release();
+    mDPValid = false;
 }
 
-template <class T>
-cv::Mat getConvertMatFromVector(std::vector<std::vector<T>> input_vec)
+void SeamCarver::CarveOptimalOrder(int rows, int cols) noexcept
 {
-    int rows = input_vec.size();
-    int cols = input_vec[0].size();
+    // transport map: T(r, c) is the cheapest way to remove r horizontal and c vertical seams,
+    // T(r, c) = min(T(r - 1, c) + E(horizontal seam of I(r - 1, c)), T(r, c - 1) + E(vertical seam of I(r, c - 1))).
+    // Cells only keep their step seam. The only images kept are the checkpoints, the cells of the previous
+    // row reached by a horizontal seam: the other cells of that row are rebuilt from the checkpoint on their
+    // left with the vertical step seams after it, and a checkpoint goes once the sweep has moved past it
+    SetWorkingDirection(SeamDirection::VERTICAL);
+    const bool maximize = mEnergyType == SeamEnergyType::MAX_ENERGY;
+    const int width = cols + 1;
+    const size_t cells = size_t(rows + 1) * width;
+    mTransportCost.assign(cells, 0);
+    mTransportChoice.assign(cells, 0);
+    mTransportOffset.assign(cells + 1, 0);
+    mTransportSeams.clear();
 
-    // Create an empty cv::Mat with the same dimensions as the input vector
-    cv::Mat output_mat(rows, cols, CV_32FC1);
+    const cv::Mat image = mCarvedImage;
+    const cv::Mat mask = mProtectionMask;
+    std::vector<cv::Mat> checkpoints(width), checkpointMasks(width), nextCheckpoints(width), nextCheckpointMasks(width);
+    std::vector<std::vector<int>> upSeams(width), nextUpSeams(width);
+    std::vector<int64_t> upCosts(width), nextUpCosts(width);
+    std::vector<int> leftSeam;
+    int64_t leftCost = 0;
+    // the step seams are removed in place, from a copy while the image is also a checkpoint
+    cv::Mat current, currentMask, above, aboveMask;
+    bool currentKept = false;
 
-    // Copy the values from the input vector to the output matrix
-    for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < cols; j++) {
-            output_mat.at<float>(i, j) = input_vec[i][j];
+    for (int r = 0; r <= rows; r++) {
+        int aboveCol = -1;
+        for (int c = 0; c <= cols; c++) {
+            const size_t cell = size_t(r) * width + c;
+            bool up = false;
+            if (r == 0 && c == 0)
+            {
+                current = image.clone();
+                currentMask = mask.clone();
+            }
+            else
+            {
+                const int64_t upTotal = r > 0 ? mTransportCost[cell - width] + upCosts[c] : 0;
+                const int64_t leftTotal = c > 0 ? mTransportCost[cell - 1] + leftCost : 0;
+                up = c == 0 || (r > 0 && (maximize ? upTotal > leftTotal : upTotal < leftTotal));
+                mTransportCost[cell] = up ? upTotal : leftTotal;
+                mTransportChoice[cell] = up;
+                const std::vector<int> &step = up ? upSeams[c] : leftSeam;
+                mTransportSeams.insert(mTransportSeams.end(), step.begin(), step.end());
+
+                if (up)
+                {
+                    // image of (r - 1, c): the last checkpoint up to c, then the vertical step seams after it
+                    int start = c;
+                    while (start > 0 && !mTransportChoice[size_t(r - 1) * width + start]) start--;
+                    if (aboveCol < start)
+                    {
+                        above = std::move(checkpoints[start]);
+                        aboveMask = std::move(checkpointMasks[start]);
+                        aboveCol = start;
+                    }
+                    while (aboveCol < c) {
+                        const size_t stepCell = size_t(r - 1) * width + (++aboveCol);
+                        mSeam.assign(mTransportSeams.begin() + mTransportOffset[stepCell], mTransportSeams.begin() + mTransportOffset[stepCell + 1]);
+                        RemoveStepSeam(&above, &aboveMask, false, mSeam);
+                    }
+                    current = above.clone();
+                    currentMask = aboveMask.clone();
+                }
+                else if (currentKept)
+                {
+                    current = current.clone();
+                    currentMask = currentMask.clone();
+                }
+                RemoveStepSeam(&current, &currentMask, up, step);
+            }
+            mTransportOffset[cell + 1] = mTransportSeams.size();
+
+            currentKept = up || c == 0;
+            if (currentKept)
+            {
+                nextCheckpoints[c] = current;
+                nextCheckpointMasks[c] = currentMask;
+            }
+            if (c < cols) leftCost = FindStepSeam(current, currentMask, false, &leftSeam);
+            if (r < rows) nextUpCosts[c] = FindStepSeam(current, currentMask, true, &nextUpSeams[c]);
+        }
+        std::swap(checkpoints, nextCheckpoints);
+        std::swap(checkpointMasks, nextCheckpointMasks);
+        for (int c = 0; c < width; c++) {
+            nextCheckpoints[c].release();
+            nextCheckpointMasks[c].release();
         }
+        std::swap(upSeams, nextUpSeams);
+        std::swap(upCosts, nextUpCosts);
+    }
+
+    // replay the cheapest path on the working maps
+    mCarvedImage = image;
+    mProtectionMask = mask;
+    mEnergyMap.release();
+    mGrayImage.release();
+    mDPValid = false;
+    mSpansValid = false;
+    std::vector<size_t> path;
+    for (size_t cell = cells - 1; cell != 0; cell -= mTransportChoice[cell] ? width : 1) {
+        path.push_back(cell);
+    }
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+        SetWorkingDirection(mTransportChoice[*it] ? SeamDirection::HORIZONTAL : SeamDirection::VERTICAL);
+        mSeam.assign(mTransportSeams.begin() + mTransportOffset[*it], mTransportSeams.begin() + mTransportOffset[*it + 1]);
+        CarveSeams(mSeam, 1);
     }
-    return output_mat;
 }
 
-void SeamCarver::CalcDynamicProgramming(const cv::Mat& energy_map, std::vector<int>* seam, SeamDirection seam_direction, SeamEnergyType energy_type) noexcept
+int64_t SeamCarver::FindStepSeam(const cv::Mat &image, const cv::Mat &mask, bool horizontal, std::vector<int>* seam) noexcept
 {
-    if (!energy_map.empty() && !seam->empty())
+    // the energy of the best seam of a transport map cell, horizontal seams on the transposed image. The
+    // working maps may still share the data of a cell image, the transposes go to their own workspace
+    if (horizontal)
     {
-        assert(seam);
-        const int rows = energy_map.rows;
-        const int cols = energy_map.cols;
-        std::vector<std::vector<float>> dp;
-        std::vector<std::vector<int>> dp_path;
-
-        if (seam_direction == SeamDirection::HORIZONTAL) {
-            dp = std::vector<std::vector<float>>(rows, std::vector<float>(cols, 0.f));
-            dp_path = std::vector<std::vector<int>>(rows, std::vector<int>(cols, 0));
+        mCarvedImage = WorkspaceView(mStepBuffers[0], cv::Size(image.rows, image.cols), image.type());
+        cv::transpose(image, mCarvedImage);
+        if (!mask.empty())
+        {
+            mProtectionMask = WorkspaceView(mStepBuffers[1], cv::Size(mask.rows, mask.cols), mask.type());
+            cv::transpose(mask, mProtectionMask);
         }
         else
         {
-            dp = std::vector<std::vector<float>>(cols, std::vector<float>(rows, 0.f));
-            dp_path = std::vector<std::vector<int>>(cols, std::vector<int>(rows, 0));
-        }
-
-        // Initialize first row or column of dp matrix
-        for (int i = 0; i < dp.size(); ++i) {
-            int x = seam_direction == SeamDirection::HORIZONTAL ? 0 : i;
-            int y = seam_direction == SeamDirection::VERTICAL ? 0 : i;
-            dp[i][0] = energy_map.at<float>(cv::Point(x, y));
-            dp_path[i][0] = i;
-        }
-
-        // Compute dynamic programming matrix
-        int dpSize = dp.size();
-        int dp0Size = dp[0].size();
-        for (int j = 1; j < dp0Size; ++j) {
-            for (int i = 0; i < dpSize; ++i) {
-                int x = seam_direction == SeamDirection::HORIZONTAL ? j : i;
-                int y = seam_direction == SeamDirection::VERTICAL ? j : i;
-
-                float energy_min = energy_type == SeamEnergyType::MIN_ENERGY ? std::numeric_limits<float>::max() : -std::numeric_limits<float>::max();
-                int parent_idx = i;
-                for (int k = -1; k <= 1; ++k) {
-                    if ((i + k >= 0) && (i + k < dpSize)) {
-                        float energy_prev = dp[i+k][j-1];
-                        if (energy_type == SeamEnergyType::MAX_ENERGY) energy_prev *= -1;
-                        if (energy_prev < energy_min) {
-                            energy_min = energy_prev;
-                            parent_idx = i + k;
-                        }
-                    }
+            mProtectionMask.release();
+        }
+    }
+    else
+    {
+        mCarvedImage = image;
+        mProtectionMask = mask;
+    }
+    mSpansValid = false;
+    CalcEnergyMap();
+    CalcDynamicProgramming(mEnergyMap, seam, mEnergyType);
+    mDPValid = false;
+    return CostRow(mDPLength - 1)[seam->back()];
+}
+
+void SeamCarver::RemoveStepSeam(cv::Mat* image, cv::Mat* mask, bool horizontal, const std::vector<int> &seam) noexcept
+{
+    // in place: a vertical seam closes its gap in every row, a horizontal one moves the pixels below it up
+    // by one row in every column, without transposing the cell
+    cv::Mat* maps[] = { image, mask };
+    for (cv::Mat* map : maps) {
+        if (map->empty()) {
+            continue;
+        }
+        if (!horizontal) {
+            RemoveSeams(&map, 1, seam, 1);
+            continue;
+        }
+        const size_t elemSize = map->elemSize();
+        for (int i = 0; i + 1 < map->rows; i++) {
+            uchar* dst = map->ptr<uchar>(i);
+            const uchar* src = map->ptr<uchar>(i + 1);
+            for (int j = 0; j < map->cols; j++) {
+                if (seam[j] <= i) std::memcpy(dst + j * elemSize, src + j * elemSize, elemSize);
+            }
+        }
+        *map = map->rowRange(0, map->rows - 1);
+    }
+}
+
+void SeamCarver::RefineSeam(const cv::Mat& energy_map, const int* coarse, int coarse_length, int scale, int radius, std::vector<int>* seam, SeamEnergyType energy_type) noexcept
+{
+    if (energy_type == SeamEnergyType::MIN_ENERGY)
+        RefineSeam<SeamEnergyType::MIN_ENERGY>(energy_map, coarse, coarse_length, scale, radius, seam);
+    else if (energy_type == SeamEnergyType::FORWARD_ENERGY)
+        RefineSeam<SeamEnergyType::FORWARD_ENERGY>(energy_map, coarse, coarse_length, scale, radius, seam);
+    else
+        RefineSeam<SeamEnergyType::MAX_ENERGY>(energy_map, coarse, coarse_length, scale, radius, seam);
+}
+
+template <SeamEnergyType energy_type>
+void SeamCarver::RefineSeam(const cv::Mat& energy_map, const int* coarse, int coarse_length, int scale, int radius, std::vector<int>* seam) noexcept
+{
+    using Traits = SeamEnergyTraits<energy_type>;
+    const int length = energy_map.rows;
+    const int width = energy_map.cols;
+    ResizeDynamicProgramming(length, width);
+
+    // the dp only runs in a band of +-radius around the upscaled coarse seam; the bands of two consecutive
+    // rows always overlap, the cells of the previous row outside its band are turned into sentinels
+    auto band = [&](int j) {
+        int center = std::clamp(coarse[std::min(j / scale, coarse_length - 1)] * scale + scale / 2, 0, width - 1);
+        return cv::Range(std::max(0, center - radius), std::min(width, center + radius + 1));
+    };
+    auto relax = [&](int j, int32_t* prev, int32_t* cost, int8_t* parent) {
+        const cv::Range current = band(j);
+        const cv::Range previous = band(j - 1);
+        std::fill(prev + current.start - 1, prev + std::max(current.start - 1, std::min(previous.start, current.end + 1)), Traits::worst);
+        std::fill(prev + std::min(current.end + 1, std::max(previous.end, current.start - 1)), prev + current.end + 1, Traits::worst);
+        RelaxRow<energy_type>(energy_map, j, prev, cost, parent, current.start, current.end);
+    };
+
+    const cv::Range first = band(0);
+    const uint16_t* energy = energy_map.ptr<uint16_t>(0);
+    std::copy(energy + first.start, energy + first.end, CostRow(0) + first.start);
+    std::fill(ParentRow(0) + first.start, ParentRow(0) + first.end, int8_t(0));
+    BlockRow<energy_type>(energy_map, 0, CostRow(0), first.start, first.end);
+    SaveCheckpoint(0);
+    for (int j = 1; j < length; ++j) {
+        relax(j, CostRow(j - 1), CostRow(j), ParentRow(j));
+        SaveCheckpoint(j);
+    }
+
+    const cv::Range previous = band(length - 1);
+    int seam_idx = previous.start;
+    const int32_t* last = CostRow(length - 1);
+    for (int i = previous.start + 1; i < previous.end; ++i) {
+        if (Traits::Better(last[i], last[seam_idx])) {
+            seam_idx = i;
+        }
+    }
+    BacktrackPath(seam_idx, seam, relax);
+    mDPValid = false;
+}
+
+template <SeamEnergyType energy_type>
+void SeamCarver::CalcDynamicProgramming(const cv::Mat& energy_map, std::vector<int>* seam) noexcept
+{
+    using Traits = SeamEnergyTraits<energy_type>;
+    // one dp row per image row, horizontal seams are carved on the transposed maps (SetWorkingDirection)
+    const int length = energy_map.rows;
+    const int width = energy_map.cols;
+    ResizeDynamicProgramming(length, width);
+
+    const int threads = mThreadCount > 0 ? mThreadCount : cv::getNumThreads();
+    const int tiles = std::min(threads, width / dpMinTileWidth);
+    for (int j = 0; j < length; ++j) {
+        const uint16_t* energy = energy_map.ptr<uint16_t>(j);
+
+        // the sentinels stand in for the out of range neighbours of the first and last cell
+        int32_t* cost = CostRow(j);
+        int8_t* parent = ParentRow(j);
+        cost[-1] = Traits::worst;
+        cost[width] = Traits::worst;
+
+        if (j == 0) {
+            std::copy(energy, energy + width, cost);
+            std::fill(parent, parent + width, int8_t(0));
+            BlockRow<energy_type>(energy_map, 0, cost, 0, width);
+            SaveCheckpoint(0);
+            if (tiles > 1) {
+                for (int i = 1; i < mCostRows; ++i) {
+                    CostRow(i)[-1] = Traits::worst;
+                    CostRow(i)[width] = Traits::worst;
                 }
-                dp[i][j] = energy_map.at<float>(cv::Point(x, y)) + energy_min;
-                dp_path[i][j] = parent_idx;
+                CalcDynamicProgrammingParallel<energy_type>(energy_map, tiles);
+                break;
             }
         }
+        else {
+            RelaxRow<energy_type>(energy_map, j, CostRow(j - 1), cost, parent, 0, width);
+            SaveCheckpoint(j);
+        }
+    }
 
-        cv::Mat dpMat = getConvertMatFromVector(dp);
-        cv::Mat dp_pathMat = getConvertMatFromVector(dp_path);
-        // Find seam with minimum or maximum energy
-        seam->resize(dp0Size);
-        float energy_seam = energy_type == SeamEnergyType::MIN_ENERGY ? std::numeric_limits<float>::max() : -std::numeric_limits<float>::max();
-        int seam_idx = 0;
-        for (int i = 0; i < dpSize; ++i) {
+    BacktrackSeam<energy_type>(energy_map, seam);
+    mDPValid = true;
+    if (HasBarriers(energy_map) && CrossesBarriers(*seam))
+    {
+        // the barriers leave no way through: search without them, with the energy they skipped
+        mSpans.clear();
+        std::fill(mSpanIndex.begin(), mSpanIndex.end(), 0);
+        if (&energy_map == &mEnergyMap) CalcEnergyMap();
+        CalcDynamicProgramming<energy_type>(energy_map, seam);
+    }
+}
+
+bool SeamCarver::CrossesBarriers(const std::vector<int> &seam) const noexcept
+{
+    // the seam against the spans of each row: the cost of a crossing tells nothing under a maximum search
+    for (int j = 0; j < static_cast<int>(seam.size()); j++) {
+        for (int s = mSpanIndex[j]; s < mSpanIndex[j + 1] && mSpans[s].start <= seam[j]; s++) {
+            if (seam[j] < mSpans[s].end) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+template <SeamEnergyType energy_type>
+void SeamCarver::CalcDynamicProgrammingParallel(const cv::Mat& energy_map, int tiles) noexcept
+{
+    using Traits = SeamEnergyTraits<energy_type>;
+    const int length = mDPLength;
+    const int width = mDPWidth;
+    const int stride = mDPStride;
+
+    // every tile has two cost rows and a parent row of its own
+    mTileCost.resize(size_t(tiles) * 2 * stride);
+    mTileParent.resize(size_t(tiles) * stride);
+
+    // the rows after row 0 go in bands of dpBandRows. A tile owns the columns [x0, x1) of the band, but
+    // starts dpBandRows - 1 cells wider on both sides and narrows by one per row, so the cells it needs
+    // from the previous row are always its own: the tiles only meet at the end of each band
+    for (int j0 = 1; j0 < length; j0 += dpBandRows) {
+        const int j1 = std::min(length, j0 + dpBandRows);
+        cv::parallel_for_(cv::Range(0, tiles), [&](const cv::Range& range) {
+            for (int t = range.start; t < range.end; ++t) {
+                const int x0 = static_cast<int>(int64_t(width) * t / tiles);
+                const int x1 = static_cast<int>(int64_t(width) * (t + 1) / tiles);
+                int32_t* buffer = &mTileCost[size_t(t) * 2 * stride];
+                int32_t* rows[2] = { buffer + 1, buffer + stride + 1 };
+                int8_t* parent = &mTileParent[size_t(t) * stride];
+                rows[0][-1] = rows[1][-1] = Traits::worst;
+                rows[0][width] = rows[1][width] = Traits::worst;
+
+                for (int j = j0; j < j1; ++j) {
+                    const int halo = j1 - 1 - j;
+                    const int begin = std::max(0, x0 - halo);
+                    const int end = std::min(width, x1 + halo);
+                    const int32_t* prev = j == j0 ? CostRow(j - 1) : rows[(j - 1 - j0) & 1];
+                    int32_t* cost = rows[(j - j0) & 1];
+
+                    RelaxRow<energy_type>(energy_map, j, prev, cost, parent, begin, end);
+                    std::copy(cost + x0, cost + x1, CostRow(j) + x0);
+                    std::copy(parent + x0, parent + x1, ParentRow(j) + x0);
+                }
+            }
+        }, tiles);
+        for (int j = j0; j < j1; ++j) {
+            SaveCheckpoint(j);
+        }
+    }
+}
+
+template <SeamEnergyType energy_type>
+void SeamCarver::UpdateDynamicProgramming(const cv::Mat& energy_map, const std::vector<int> &seam) noexcept
+{
+    using Traits = SeamEnergyTraits<energy_type>;
+    const int width = mDPWidth - 1;
+    const int stride = mDPStride;
+    mCostLine.resize(width);
+
+    // a cell has to be recomputed if its energy changed (mEnergyBand) or one of its three parents did;
+    // everything else only moves one to the left together with its parents, like the image itself
+    int changedBegin = 0;
+    int changedEnd = 0;
+    for (int j = 0; j < mDPLength; ++j) {
+        int32_t* cost = &mCostMap[size_t(j) * stride + 1];
+        int8_t* parent = &mParentMap[size_t(j) * stride];
+        const int seam_idx = seam[j];
+        std::memmove(cost + seam_idx, cost + seam_idx + 1, (width - seam_idx) * sizeof(int32_t));
+        std::memmove(parent + seam_idx, parent + seam_idx + 1, (width - seam_idx) * sizeof(int8_t));
+        cost[width] = Traits::worst;
+
+        int begin = mEnergyBand[j].start;
+        int end = mEnergyBand[j].end;
+        if (changedBegin < changedEnd) {
+            begin = std::max(0, std::min(begin, changedBegin - 1));
+            end = std::min(width, std::max(end, changedEnd + 1));
+        }
+
+        const uint16_t* energy = energy_map.ptr<uint16_t>(j);
+        std::copy(cost + begin, cost + end, mCostLine.begin());
+        if (j == 0) {
+            std::copy(energy + begin, energy + end, cost + begin);
+            std::fill(parent + begin, parent + end, int8_t(0));
+            BlockRow<energy_type>(energy_map, 0, cost, begin, end);
+        }
+        else {
+            RelaxRow<energy_type>(energy_map, j, cost - stride, cost, parent, begin, end);
+        }
 
-            float energy_i = dp[i][dp0Size - 1];
-            if (energy_type == SeamEnergyType::MAX_ENERGY) energy_i *= -1;
-            if (energy_i < energy_seam) {
-                energy_seam = energy_i;
-                seam_idx = i;
+        changedBegin = end;
+        changedEnd = begin;
+        for (int i = begin; i < end; ++i) {
+            if (cost[i] != mCostLine[i - begin]) {
+                changedBegin = std::min(changedBegin, i);
+                changedEnd = i + 1;
             }
         }
+    }
+
+    mDPWidth = width;
+    mDPValid = true;
+}
+
+void SeamCarver::UpdateDynamicProgramming(const cv::Mat& energy_map, const std::vector<int> &seam, SeamEnergyType energy_type) noexcept
+{
+    if (!energy_map.empty() && mDPLength == energy_map.rows && mDPWidth == energy_map.cols + 1 && mCostRows == mDPLength &&
+        mEnergyBand.size() == static_cast<size_t>(energy_map.rows) && seam.size() == mEnergyBand.size())
+    {
+        if (energy_type == SeamEnergyType::MIN_ENERGY)
+            UpdateDynamicProgramming<SeamEnergyType::MIN_ENERGY>(energy_map, seam);
+        else if (energy_type == SeamEnergyType::FORWARD_ENERGY)
+            UpdateDynamicProgramming<SeamEnergyType::FORWARD_ENERGY>(energy_map, seam);
+        else
+            UpdateDynamicProgramming<SeamEnergyType::MAX_ENERGY>(energy_map, seam);
+    }
+}
+
+template <SeamEnergyType energy_type>
+void SeamCarver::RelaxRow(const cv::Mat& energy_map, int row, const int32_t* prev, int32_t* cost, int8_t* parent, int begin, int end) const noexcept
+{
+    // prev, cost and parent point at column 0, only the cells [begin, end) are written
+    const uint16_t* energy = energy_map.ptr<uint16_t>(row);
+    auto relax = [&](int first, int last) {
+        if constexpr (energy_type == SeamEnergyType::FORWARD_ENERGY)
+        {
+            // the transition costs come from the gray image the energy map belongs to
+            const cv::Mat& gray = energy_map.size() == mGrayImage.size() ? mGrayImage : mDPGray;
+            RelaxSeamRowForward(prev, energy, gray.ptr<uchar>(row - 1), gray.ptr<uchar>(row), cost, parent, first, last, energy_map.cols);
+        }
+        else
+        {
+            RelaxSeamRow<energy_type>(prev + first, energy + first, cost + first, parent + first, last - first);
+        }
+    };
+    if (!HasBarriers(energy_map))
+    {
+        relax(begin, end);
+        return;
+    }
+
+    // restricted search: only the gaps between the protected spans are relaxed, the spans are barriers
+    int x = begin;
+    for (int s = mSpanIndex[row]; s < mSpanIndex[row + 1] && x < end; s++) {
+        const int start = std::clamp(mSpans[s].start, x, end);
+        const int stop = std::clamp(mSpans[s].end, x, end);
+        if (start > x) relax(x, start);
+        std::fill(cost + start, cost + stop, barrierCost<energy_type>);
+        std::fill(parent + start, parent + stop, int8_t(0));
+        x = stop;
+    }
+    if (x < end) relax(x, end);
+}
 
-        // Backtrack to find seam indices
-        for (int j = dp0Size - 1; j >= 0; --j) {
-            (*seam)[j] = seam_direction == SeamDirection::VERTICAL ? seam_idx : dpSize - 1 - seam_idx;
-            seam_idx = dp_path[(*seam)[j]][j];
+template <SeamEnergyType energy_type>
+void SeamCarver::BlockRow(const cv::Mat& energy_map, int row, int32_t* cost, int begin, int end) const noexcept
+{
+    // the barriers of a row that is not relaxed, the first one of the table
+    if (HasBarriers(energy_map))
+    {
+        for (int s = mSpanIndex[row]; s < mSpanIndex[row + 1]; s++) {
+            const int start = std::clamp(mSpans[s].start, begin, end);
+            std::fill(cost + start, cost + std::clamp(mSpans[s].end, begin, end), barrierCost<energy_type>);
         }
+    }
+}
+
+template <SeamEnergyType energy_type>
+void SeamCarver::BacktrackSeam(const cv::Mat& energy_map, std::vector<int>* seam) noexcept
+{
+    using Traits = SeamEnergyTraits<energy_type>;
+
+    // Find seam with minimum or maximum energy
+    const int32_t* last = CostRow(mDPLength - 1);
+    int seam_idx = 0;
+    for (int i = 1; i < mDPWidth; ++i) {
+        if (Traits::Better(last[i], last[seam_idx])) {
+            seam_idx = i;
+        }
+    }
+
+    // Backtrack to find seam indices
+    BacktrackPath(seam_idx, seam, [this, &energy_map](int j, int32_t* prev, int32_t* cost, int8_t* parent) {
+        RelaxRow<energy_type>(energy_map, j, prev, cost, parent, 0, mDPWidth);
+    });
+}
+
+void SeamCarver::CalcDynamicProgramming(const cv::Mat& energy_map, std::vector<int>* seam, SeamEnergyType energy_type) noexcept
+{
+    if (!energy_map.empty() && seam)
+    {
+        if (!mSpansValid)
+        {
+            BuildProtectedSpans();
+        }
+        if (energy_type == SeamEnergyType::MIN_ENERGY)
+            CalcDynamicProgramming<SeamEnergyType::MIN_ENERGY>(energy_map, seam);
+        else if (energy_type == SeamEnergyType::FORWARD_ENERGY)
+            CalcDynamicProgramming<SeamEnergyType::FORWARD_ENERGY>(energy_map, seam);
+        else
+            CalcDynamicProgramming<SeamEnergyType::MAX_ENERGY>(energy_map, seam);
 
         // cv::Mat debug;
         // cv::cvtColor(energy_map, debug, cv::COLOR_GRAY2RGB);
-        // if (seam_direction == SeamDirection::VERTICAL)
+        // for (int i = 0; i < debug.rows; i++)
         // {
-        //     for (int i = 0; i < debug.rows; i++)
-        //     {
-        //         debug.at<cv::Vec3f>(i, (*seam)[i]) = cv::Vec3f(0, 0, 255);
-        //     }
-        // }
-        // else
-        // {
-        //     for (int i = 0; i < debug.cols; i++)
-        //     {
-        //         debug.at<cv::Vec3f>((*seam)[i], i) = cv::Vec3f(0, 0, 255);
-        //     }
+        //     debug.at<cv::Vec3f>(i, (*seam)[i]) = cv::Vec3f(0, 0, 255);
         // }
         // cv::imshow("debug", debug);
         // cv::waitKey(0);
     }
 }
 
-void SeamCarver::RemoveSeam(cv::Mat& image, const std::vector<int> &seam, SeamDirection direction) noexcept
+void SeamCarver::BacktrackSeam(const cv::Mat& energy_map, std::vector<int>* seam, SeamEnergyType energy_type) noexcept
 {
-    if (!image.empty() && !seam.empty())
+    // the energy type also tells how a streamed table replays its parents
+    if (energy_type == SeamEnergyType::MIN_ENERGY)
+        BacktrackSeam<SeamEnergyType::MIN_ENERGY>(energy_map, seam);
+    else if (energy_type == SeamEnergyType::FORWARD_ENERGY)
+        BacktrackSeam<SeamEnergyType::FORWARD_ENERGY>(energy_map, seam);
+    else
+        BacktrackSeam<SeamEnergyType::MAX_ENERGY>(energy_map, seam);
+}
+
+int SeamCarver::BacktrackSeams(const cv::Mat& energy_map, int count, std::vector<int>* seams, SeamEnergyType energy_type) noexcept
+{
+    if (energy_type == SeamEnergyType::MIN_ENERGY)
+        return BacktrackSeams<SeamEnergyType::MIN_ENERGY>(energy_map, count, seams);
+    if (energy_type == SeamEnergyType::FORWARD_ENERGY)
+        return BacktrackSeams<SeamEnergyType::FORWARD_ENERGY>(energy_map, count, seams);
+    return BacktrackSeams<SeamEnergyType::MAX_ENERGY>(energy_map, count, seams);
+}
+
+template <SeamEnergyType energy_type>
+int SeamCarver::BacktrackSeams(const cv::Mat& energy_map, int count, std::vector<int>* seams) noexcept
+{
+    using Traits = SeamEnergyTraits<energy_type>;
+    const int stride = mDPStride;
+    const int length = mDPLength;
+    const int32_t* last = CostRow(length - 1);
+
+    mSeamOrder.resize(mDPWidth);
+    for (int i = 0; i < mDPWidth; ++i) {
+        mSeamOrder[i] = i;
+    }
+    // ties by column, as a stable sort would, but without its temporary buffer
+    std::sort(mSeamOrder.begin(), mSeamOrder.end(), [last](int a, int b) {
+        return Traits::Better(last[a], last[b]) || (last[a] == last[b] && a < b);
+    });
+    if (mParentRows < length)
     {
-        int rows = image.rows;
-        int cols = image.cols;
-    
-        if (direction == SeamDirection::VERTICAL) {
-            // Remove pixels from left to right
-            for (int i = 0; i < rows; i++) {
-                int seam_idx = seam[i];
-                cv::Mat row = image.row(i);
-                cv::Rect roi(seam_idx, 0, cols - seam_idx - 1, 1);
-                if (RoiRefine(roi, row.size()) && seam_idx != 0)
-                {
-                    cv::Mat submat = row(roi);
-                    submat.copyTo(row(cv::Rect(seam_idx - 1, 0, cols - seam_idx - 1, 1)));
-                }
+        return BacktrackStreamedSeams<energy_type>(energy_map, count, seams);
+    }
+
+    // paths of the parent tree never cross, but they merge: a path that runs into a cell taken by a
+    // better seam is dropped, so the seams of a batch never share a pixel
+    mSeamMask.assign(size_t(length) * stride, 0);
+    seams->resize(size_t(count) * length);
+    int found = 0;
+    for (int k = 0; k < mDPWidth && found < count; ++k) {
+        int* seam = &(*seams)[size_t(found) * length];
+        int seam_idx = mSeamOrder[k];
+        int j = length - 1;
+        for (; j >= 0 && !mSeamMask[size_t(j) * stride + seam_idx]; --j) {
+            seam[j] = seam_idx;
+            seam_idx += mParentMap[size_t(j) * stride + seam_idx];
+        }
+        if (j < 0) {
+            for (j = 0; j < length; ++j) {
+                mSeamMask[size_t(j) * stride + seam[j]] = 1;
             }
-            // Reduce image width by 1
-            image = image(cv::Rect(0, 0, cols-1, rows));
+            found++;
         }
-        else {
-            // Remove pixels from top to bottom
-            for (int j = 0; j < cols; j++) {
-                int seam_idx = seam[j];
-                cv::Mat col = image.col(j);
-                cv::Rect roi(0, seam_idx, 1, rows - seam_idx - 1);
-                if (RoiRefine(roi, col.size()) && seam_idx != 0)
-                {
-                    cv::Mat submat = col(roi);
-                    submat.copyTo(col(cv::Rect(0, seam_idx - 1, 1, rows - seam_idx - 1)));
+    }
+    return found;
+}
+
+template <SeamEnergyType energy_type>
+int SeamCarver::BacktrackStreamedSeams(const cv::Mat& energy_map, int count, std::vector<int>* seams) noexcept
+{
+    // a streamed table is walked a row at a time, by all paths together in the order of mSeamOrder. A path
+    // that runs into a cell taken by a better one in the same row is dropped: merged paths stay merged, so
+    // the paths left are those that share no cell with a better path, the seams of the walk above. A second
+    // walk writes the first count of them
+    const int length = mDPLength;
+    const int width = mDPWidth;
+    auto relax = [this, &energy_map](int j, int32_t* prev, int32_t* cost, int8_t* parent) {
+        RelaxRow<energy_type>(energy_map, j, prev, cost, parent, 0, mDPWidth);
+    };
+    mSeamPositions.assign(mSeamOrder.begin(), mSeamOrder.end());
+    mSeamMask.assign(width, 1);
+    mSeamTaken.assign(width, -1);
+    for (int j = length - 1; j >= 0; --j) {
+        if (j > 0) ReplayParents(j, relax);
+        const int8_t* parent = ParentRow(j);
+        for (int k = 0; k < width; ++k) {
+            if (!mSeamMask[k]) {
+                continue;
+            }
+            int& seam_idx = mSeamPositions[k];
+            if (mSeamTaken[seam_idx] == j) {
+                mSeamMask[k] = 0;
+                continue;
+            }
+            mSeamTaken[seam_idx] = j;
+            if (j > 0) seam_idx += parent[seam_idx];
+        }
+    }
+
+    int found = 0;
+    for (int k = 0; k < width && found < count; ++k) {
+        if (mSeamMask[k]) mSeamPositions[found++] = mSeamOrder[k];
+    }
+    seams->resize(size_t(count) * length);
+    for (int j = length - 1; j >= 0; --j) {
+        if (j > 0) ReplayParents(j, relax);
+        const int8_t* parent = ParentRow(j);
+        for (int k = 0; k < found; ++k) {
+            int& seam_idx = mSeamPositions[k];
+            (*seams)[size_t(k) * length + j] = seam_idx;
+            if (j > 0) seam_idx += parent[seam_idx];
+        }
+    }
+    return found;
+}
+
+void SeamCarver::CarveSeams(const std::vector<int> &seams, int count) noexcept
+{
+    if (!mIndexMap.empty())
+    {
+        // record when each pixel goes away, for the seam order maps of PrecomputeSeamOrder
+        int* order = (mTransposed ? mHorizontalOrder : mVerticalOrder).ptr<int>(0);
+        const int rows = mIndexMap.rows;
+        for (int k = 0; k < count; k++) {
+            for (int j = 0; j < rows; j++) {
+                order[mIndexMap.at<int>(j, seams[size_t(k) * rows + j])] = mSeamCount + k;
+            }
+        }
+    }
+
+    // every map that follows the carved image pixel for pixel loses the same pixels in one pass
+    cv::Mat* maps[] = { &mCarvedImage, &mProtectionMask, &mRemovalMask, &mIndexMap, &mGrayImage, &mEnergyMap };
+    cv::Mat* planes[std::size(maps)];
+    int planeCount = 0;
+    for (cv::Mat* map : maps) {
+        if (!map->empty() && map->size() == mCarvedImage.size()) {
+            planes[planeCount++] = map;
+        }
+    }
+    if (mRecordSequence) RecordSequenceStep(seams, count, false);
+    CarveProtectedSpans(seams, count);
+    RemoveSeams(planes, planeCount, seams, count);
+    mSeamCount += count;
+}
+
+void SeamCarver::RemoveSeams(cv::Mat* const* planes, int planeCount, const std::vector<int> &seams, int count) noexcept
+{
+    if (planeCount > 0 && count > 0)
+    {
+        const int rows = planes[0]->rows;
+        const int cols = planes[0]->cols;
+        mSeamPositions.resize(count);
+
+        for (int i = 0; i < rows; i++) {
+            for (int k = 0; k < count; k++) {
+                mSeamPositions[k] = seams[size_t(k) * rows + i];
+            }
+            if (count > 1) {
+                std::sort(mSeamPositions.begin(), mSeamPositions.end());
+            }
+
+            // close the gaps left by the seams: every run between two seams moves left by the seams before it
+            for (int p = 0; p < planeCount; p++) {
+                const size_t elemSize = planes[p]->elemSize();
+                uchar* row = planes[p]->ptr<uchar>(i);
+                int dst = mSeamPositions[0];
+                for (int k = 0; k < count; k++) {
+                    const int begin = mSeamPositions[k] + 1;
+                    const int end = k + 1 < count ? mSeamPositions[k + 1] : cols;
+                    std::memmove(row + dst * elemSize, row + begin * elemSize, (end - begin) * elemSize);
+                    dst += end - begin;
                 }
             }
-            // Reduce image height by 1
-            image = image(cv::Rect(0, 0, cols, rows-1));
+        }
+
+        for (int p = 0; p < planeCount; p++) {
+            *planes[p] = (*planes[p])(cv::Rect(0, 0, cols - count, rows));
         }
     }
 }
 
+template <typename T>
+static void InsertSeamPixels(const uchar* src, uchar* dst, int cols, int channels, const int* positions, int count, bool average) noexcept
+{
+    // copies one row and inserts a pixel right after each seam position: the mean of the seam pixel and its
+    // right neighbour (left one on the last column, itself on a single column), or the seam pixel itself for masks
+    const T* in = reinterpret_cast<const T*>(src);
+    T* out = reinterpret_cast<T*>(dst);
+    int begin = 0;
+    for (int k = 0; k < count; k++) {
+        const int seam = positions[k];
+        std::memcpy(out, in + size_t(begin) * channels, size_t(seam + 1 - begin) * channels * sizeof(T));
+        out += size_t(seam + 1 - begin) * channels;
+        const T* pixel = in + size_t(seam) * channels;
+        const T* neighbour = seam + 1 < cols ? pixel + channels : cols > 1 ? pixel - channels : pixel;
+        for (int c = 0; c < channels; c++) {
+            out[c] = average ? static_cast<T>((pixel[c] + neighbour[c] + std::is_integral_v<T>) / 2) : pixel[c];
+        }
+        out += channels;
+        begin = seam + 1;
+    }
+    std::memcpy(out, in + size_t(begin) * channels, size_t(cols - begin) * channels * sizeof(T));
+}
+
+void SeamCarver::DuplicateSeams(const std::vector<int> &seams, int count) noexcept
+{
+    if (count <= 0 || mCarvedImage.empty())
+    {
+        return;
+    }
+
+    if (mRecordSequence) RecordSequenceStep(seams, count, true);
+
+    // every map that follows the carved image gets the seams in one output pass; gray and energy are
+    // recomputed by the next search
+    const int rows = mCarvedImage.rows;
+    const int cols = mCarvedImage.cols;
+    cv::Mat* maps[] = { &mCarvedImage, &mProtectionMask, &mRemovalMask };
+    mSeamPositions.resize(count);
+    for (int m = 0; m < static_cast<int>(std::size(maps)); m++) {
+        cv::Mat* map = maps[m];
+        if (map->empty() || map->size() != cv::Size(cols, rows)) {
+            continue;
+        }
+        const bool average = map == &mCarvedImage;
+        const int channels = map->channels();
+        cv::Mat enlarged = MapBuffer(m, cv::Size(cols + count, rows), map->type(), *map);
+        for (int i = 0; i < rows; i++) {
+            for (int k = 0; k < count; k++) {
+                mSeamPositions[k] = seams[size_t(k) * rows + i];
+            }
+            std::sort(mSeamPositions.begin(), mSeamPositions.end());
+            const uchar* src = map->ptr<uchar>(i);
+            uchar* dst = enlarged.ptr<uchar>(i);
+            if (map->depth() == CV_32F)
+                InsertSeamPixels<float>(src, dst, cols, channels, mSeamPositions.data(), count, average);
+            else if (map->depth() == CV_8U)
+                InsertSeamPixels<uchar>(src, dst, cols, channels, mSeamPositions.data(), count, average);
+            else
+                InsertSeamPixels<uchar>(src, dst, cols, static_cast<int>(map->elemSize()), mSeamPositions.data(), count, false);
+        }
+        *map = enlarged;
+    }
+    mSpansValid = false;
+    mSeamCount += count;
+}
+
 bool SeamCarver::CheckFinishCarved() noexcept
 {
     bool finish = false;
     if(!mCarvedImage.empty())
     {
-        CalcEnergyMap();
-
-        int width = mSize.width - mCarvedImage.cols;
-        int height = mSize.height - mCarvedImage.rows;
+        cv::Size carved = CarvedSize();
+        int width = mSize.width - carved.width;
+        int height = mSize.height - carved.height;
 
         if(width == height && width == 0)
         {
             finish = true;
         }
-        else
+        else if (mSeamCount == 0 || (mDirection == SeamDirection::VERTICAL ? width == 0 : height == 0))
         {
-            mDirection = (width < height) ? SeamDirection::VERTICAL : SeamDirection::HORIZONTAL;
+            // a direction is kept until it is done, every switch transposes the working maps
+            mDirection = (std::abs(width) > std::abs(height)) ? SeamDirection::VERTICAL : SeamDirection::HORIZONTAL;
         }
     }
     return !finish;
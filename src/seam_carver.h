@@ -1,5 +1,7 @@
 #ifndef _SEAM_CARVER_H_
 #define _SEAM_CARVER_H_
+#include <cstdint>
+#include <functional>
 #include <vector>
 #include "opencv2/core.hpp"
 
@@ -10,35 +12,198 @@ enum class SeamDirection {
 
 enum class SeamEnergyType {
   MIN_ENERGY,
-  MAX_ENERGY
+  MAX_ENERGY,
+  FORWARD_ENERGY  // minimal cost of the new edges a removal creates, computed inside the dp
 };
 
+// debug output of the carver: a name ("energy", "carved") and an image that is only valid during the call
+using SeamDebugCallback = std::function<void(const char* name, const cv::Mat& image)>;
+
 class SeamCarver {
 public:
 	explicit SeamCarver();
 	void Inspection(const cv::Mat& input) noexcept;
+	void PrecomputeSeamOrder(const cv::Mat& input) noexcept;
+	cv::Mat Retarget(cv::Size size) const noexcept;
+	bool HasSeamOrder() const noexcept { return !mOriginImage.empty() && !mVerticalOrder.empty() && !mHorizontalOrder.empty(); }
 	void SetSize(cv::Size size) noexcept { mSize = size; }
 	void SetKernelSize(int kSize) noexcept { mKernelSize = kSize; }
-	void SetProtectionMask(const cv::Mat &mask) noexcept { mProtectionMask = mask; }
-	void SetRemovalMask(const cv::Mat &mask) noexcept { mRemovalMask = mask; }
+	void SetBatchSize(int batchSize) noexcept { mBatchSize = batchSize; }
+	void SetPyramidLevels(int levels) noexcept { mPyramidLevels = levels; }
+	void SetEnergyType(SeamEnergyType type) noexcept { mEnergyType = type; }
+	void SetDebugCallback(SeamDebugCallback callback) noexcept { mDebugCallback = std::move(callback); }
+	void SetThreadCount(int threads) noexcept { mThreadCount = threads; } // 0: cv::getNumThreads()
+	void SetProtectionMask(const cv::Mat &mask) noexcept { mProtectionMask = mask; mSpansValid = false; }
+	void SetRemovalMask(const cv::Mat &mask) noexcept { mRemovalMask = mask; } // removed before carving to the size
+	void SetOptimalOrder(bool enable) noexcept { mOptimalOrder = enable; }
+	void SetSeamInsertion(bool enable) noexcept { mSeamInsertion = enable; }
+	void SetIncrementalEnergy(bool enable) noexcept { mIncrementalEnergy = enable; }
+	void SetIncrementalDynamicProgramming(bool enable) noexcept { mIncrementalDP = enable; }
+	void SetTemporalCoherence(bool enable) noexcept { if (enable != mTemporalCoherence) mSequenceSteps.clear(); mTemporalCoherence = enable; } // frames reuse the seams of the previous one
+	// bytes of the scratch buffers (sobel strips, dp cost rows and parents) next to the working maps, 0: no budget.
+	// Under a tight budget the parents are streamed, at the cost of a second dp pass per seam. The maps themselves
+	// are not bounded, ExceedsScratchBudget() tells when they alone took the budget of the last call
+	void SetScratchBudget(size_t bytes) noexcept { mScratchBudget = bytes; }
+	bool ExceedsScratchBudget() const noexcept { return mBudgetExceeded; }
+	void SetRestrictedSearch(bool enable) noexcept { mRestrictedSearch = enable; mSpansValid = false; } // seams avoid the protection mask
+	// gives back the workspace, which otherwise only grows; a much smaller image releases it on its own
+	void Release() noexcept;
 	cv::Mat GetCarvedImage() noexcept {return std::move(mCarvedImage); }
+	int GetSeamCount() const noexcept { return mSeamCount; }
 private:
+	void CalcSeamOrder(const cv::Mat &image, SeamDirection direction) noexcept;
 	void CalcEnergyMap() noexcept;
+	void UpdateEnergyMap(const std::vector<int> &seam) noexcept;
+	void BuildProtectedSpans() noexcept;
+	void CarveProtectedSpans(const std::vector<int> &seams, int count) noexcept;
+	bool HasBarriers(const cv::Mat& energy_map) const noexcept;
+	bool CrossesBarriers(const std::vector<int> &seam) const noexcept;
+	uint16_t CalcEnergyAt(int x, int y) const noexcept;
 	cv::Mat CalcCarvedImage(const cv::Mat &image, cv::Size size) noexcept;
-	void FindHorizontalSeam(std::vector<int> *seam) noexcept;
 	void FindVerticalSeam(std::vector<int> *seam) noexcept;
-	void CalcDynamicProgramming(const cv::Mat& energy_map, std::vector<int>* seam, SeamDirection direction, SeamEnergyType energy_type) noexcept;
-	void RemoveSeam(cv::Mat& image, const std::vector<int> &seam, SeamDirection direction) noexcept;
+	void FindSeams(SeamDirection direction, int remaining) noexcept;
+	void FindSeamBatch(int count) noexcept;
+	void FindPyramidSeams(int count) noexcept;
+	void InsertSeams(SeamDirection direction, int count) noexcept;
+	void RemoveObject() noexcept;
+	bool MatchesSequence(const cv::Mat &input) noexcept;
+	void RecordSequenceStep(const std::vector<int> &seams, int count, bool insert) noexcept;
+	void CarveSequenceFrame() noexcept;
+	void CarveOptimalOrder(int rows, int cols) noexcept;
+	int64_t FindStepSeam(const cv::Mat &image, const cv::Mat &mask, bool horizontal, std::vector<int>* seam) noexcept;
+	void RemoveStepSeam(cv::Mat* image, cv::Mat* mask, bool horizontal, const std::vector<int> &seam) noexcept;
+	void SetWorkingDirection(SeamDirection direction) noexcept;
+	cv::Mat MapBuffer(int map, cv::Size size, int type, const cv::Mat& source) noexcept;
+	cv::Size CarvedSize() const noexcept;
+	size_t ResidentBytes() const noexcept;
+	int BudgetRows(size_t row_bytes, int rows, size_t resident) noexcept;
+	void ResizeDynamicProgramming(int length, int width) noexcept;
+	int32_t* CostRow(int row) noexcept { return &mCostMap[size_t(row % mCostRows) * mDPStride + 1]; }
+	int8_t* ParentRow(int row) noexcept { return &mParentMap[size_t(row % mParentRows) * mDPStride]; }
+	void SaveCheckpoint(int row) noexcept;
+	template <typename Relax>
+	void ReplayParents(int row, Relax relax) noexcept;
+	template <typename Relax>
+	void BacktrackPath(int seam_idx, std::vector<int>* seam, Relax relax) noexcept;
+	void CalcDynamicProgramming(const cv::Mat& energy_map, std::vector<int>* seam, SeamEnergyType energy_type) noexcept;
+	template <SeamEnergyType energy_type>
+	void CalcDynamicProgramming(const cv::Mat& energy_map, std::vector<int>* seam) noexcept;
+	template <SeamEnergyType energy_type>
+	void CalcDynamicProgrammingParallel(const cv::Mat& energy_map, int tiles) noexcept;
+	void RefineSeam(const cv::Mat& energy_map, const int* coarse, int coarse_length, int scale, int radius, std::vector<int>* seam, SeamEnergyType energy_type) noexcept;
+	template <SeamEnergyType energy_type>
+	void RefineSeam(const cv::Mat& energy_map, const int* coarse, int coarse_length, int scale, int radius, std::vector<int>* seam) noexcept;
+	void UpdateDynamicProgramming(const cv::Mat& energy_map, const std::vector<int> &seam, SeamEnergyType energy_type) noexcept;
+	template <SeamEnergyType energy_type>
+	void UpdateDynamicProgramming(const cv::Mat& energy_map, const std::vector<int> &seam) noexcept;
+	template <SeamEnergyType energy_type>
+	void RelaxRow(const cv::Mat& energy_map, int row, const int32_t* prev, int32_t* cost, int8_t* parent, int begin, int end) const noexcept;
+	template <SeamEnergyType energy_type>
+	void BlockRow(const cv::Mat& energy_map, int row, int32_t* cost, int begin, int end) const noexcept;
+	void BacktrackSeam(const cv::Mat& energy_map, std::vector<int>* seam, SeamEnergyType energy_type) noexcept;
+	template <SeamEnergyType energy_type>
+	void BacktrackSeam(const cv::Mat& energy_map, std::vector<int>* seam) noexcept;
+	int BacktrackSeams(const cv::Mat& energy_map, int count, std::vector<int>* seams, SeamEnergyType energy_type) noexcept;
+	template <SeamEnergyType energy_type>
+	int BacktrackSeams(const cv::Mat& energy_map, int count, std::vector<int>* seams) noexcept;
+	template <SeamEnergyType energy_type>
+	int BacktrackStreamedSeams(const cv::Mat& energy_map, int count, std::vector<int>* seams) noexcept;
+	void CarveSeams(const std::vector<int> &seams, int count) noexcept;
+	void RemoveSeams(cv::Mat* const* planes, int planeCount, const std::vector<int> &seams, int count) noexcept;
+	void DuplicateSeams(const std::vector<int> &seams, int count) noexcept;
 	bool CheckFinishCarved() noexcept;
 private:
 	int mKernelSize = 3;
+	int mBatchSize = 1;
+	int mPyramidLevels = 0;
+	int mThreadCount = 1;
 	cv::Size mSize{};
 	cv::Mat mOriginImage{};
 	cv::Mat mCarvedImage{};
 	cv::Mat mEnergyMap{};
+	cv::Mat mGrayImage{};
 	cv::Mat mRemovalMask{};
 	cv::Mat mProtectionMask{};
-	SeamDirection mDirection;
+	// seam order maps: the number of the seam that removes each pixel of mOriginImage, INT_MAX if none does
+	cv::Mat mVerticalOrder{};
+	cv::Mat mHorizontalOrder{};
+	cv::Mat mIndexMap{};           // original index of each pixel of mCarvedImage while the maps are built
+	SeamDirection mDirection = SeamDirection::VERTICAL;
+	bool mTransposed = false;      // the working maps hold the transposed image, carving horizontal seams
 	SeamEnergyType mEnergyType = SeamEnergyType::MIN_ENERGY;
+	bool mOptimalOrder = false;    // interleave vertical and horizontal seams by the transport map
+	bool mSeamInsertion = false;   // enlarge by inserting seams instead of scaling past the target size
+	bool mIncrementalEnergy = true;
+	bool mIncrementalDP = true;
+	int mSeamCount = 0;
+	int mRemovalArea = 0;          // masked pixels RemoveObject still has to carve away
+	bool mRestrictedSearch = false;
+	size_t mScratchBudget = 0;     // bytes of the scratch buffers next to the working maps, 0: unbounded
+	bool mBudgetExceeded = false;  // the working maps alone took the scratch budget
+	bool mTemporalCoherence = false;
+	bool mRecordSequence = false;  // CarveSeams and DuplicateSeams append their seams to the sequence
+	SeamDebugCallback mDebugCallback{};
+	// sobel kernels of CalcEnergyMap, used to recompute single pixels in UpdateEnergyMap
+	std::vector<int> mDerivKernel{};
+	std::vector<int> mSmoothKernel{};
+	int mDerivKernelSize = 0;              // kernel size of mDerivKernel and mSmoothKernel
+	// workspace: single row buffers that only grow, the maps of each image are views into them (WorkspaceView)
+	cv::Mat mGrayBuffer{};
+	cv::Mat mEnergyBuffer{};
+	cv::Mat mSobelBuffers[2]{};
+	cv::Mat mPyramidBuffers[4]{};          // energy and gray pyramid levels, two buffers each
+	// two buffers per working map, in the order of WorkingMaps(): the scaled, transposed and enlarged maps
+	// take turns in them (MapBuffer)
+	cv::Mat mMapBuffers[12]{};
+	std::vector<cv::Range> mEnergyBand{};  // pixels recomputed by the last UpdateEnergyMap, per seam step
+	cv::Mat mPyramidEnergy{};              // downscaled energy map of the pyramid search
+	cv::Mat mDPGray{};                     // gray image of a dp that does not cover mGrayImage (pyramid level, removal band)
+	std::vector<int> mSeam{};
+	std::vector<int> mSeams{};          // batch of seams, one after the other
+	std::vector<int> mCoarseSeams{};    // batch of seams found on mPyramidEnergy
+	std::vector<int> mSeamOrder{};      // end cells of the dp table sorted by cost
+	std::vector<int> mSeamPositions{};  // seam positions within one row
+	std::vector<uint8_t> mSeamMask{};   // dp cells already taken by a seam of the batch, paths left of a streamed one
+	std::vector<int> mSeamTaken{};      // last row in which a path of a streamed batch took each column
+	// seams of the last frame of a sequence, replayed within a band on the next one. A step carves count seams
+	// one after the other, or duplicates them together; the seams follow each other in mSequenceSeams
+	struct SequenceStep {
+		bool horizontal;
+		bool insert;
+		int count;
+	};
+	std::vector<SequenceStep> mSequenceSteps{};
+	std::vector<int> mSequenceSeams{};
+	cv::Mat mSequenceGray{};   // scaled gray image of the last frame
+	cv::Mat mSequenceNext{};   // scaled gray image of the current frame, swapped with mSequenceGray
+	cv::Size mSequenceInput{};
+	cv::Size mSequenceSize{};
+	// transport map of CarveOptimalOrder, (rows + 1) x (cols + 1) cells
+	std::vector<int64_t> mTransportCost{};
+	std::vector<uint8_t> mTransportChoice{};  // 1: the cell is reached by a horizontal seam
+	std::vector<int> mTransportSeams{};       // step seam of every cell, one after the other
+	std::vector<size_t> mTransportOffset{};   // start of the step seam of each cell in mTransportSeams
+	cv::Mat mStepBuffers[2]{};                // transposed cell image and mask of FindStepSeam
+	// dp buffers, reused across seams: one row per seam step, row-major with mDPStride per row
+	std::vector<int32_t> mCostMap{};   // cumulative energy, a sentinel on both ends of each row
+	std::vector<int8_t> mParentMap{};  // parent offset (-1, 0, +1) into the previous row
+	std::vector<int32_t> mCheckpoints{}; // cost rows at the start of each segment of a streamed table
+	std::vector<int32_t> mReplayCost{};  // two cost rows of the segment ReplayParents recomputes
+	std::vector<int32_t> mCostLine{};    // previous values of the cells UpdateDynamicProgramming recomputes
+	std::vector<int32_t> mTileCost{};    // private rows of the tiles of CalcDynamicProgrammingParallel
+	std::vector<int8_t> mTileParent{};
+	// runs of protected pixels of each row of the working maps, barriers of the dp: the spans of row j are
+	// mSpans[mSpanIndex[j]] to mSpans[mSpanIndex[j + 1]], moved along with the carved seams
+	std::vector<cv::Range> mSpans{};
+	std::vector<int> mSpanIndex{};
+	cv::Size mSpanSize{};
+	bool mSpansValid = false;          // the spans match mProtectionMask
+	int mCostRows = 0;                 // rows of mCostMap, fewer than mDPLength under a tight scratch budget
+	int mParentRows = 0;               // rows of mParentMap, fewer than mDPLength when the parents are streamed
+	int mParentSegment = 0;            // segment of a streamed table whose parents the ring holds
+	int mDPStride = 0;
+	int mDPLength = 0;
+	int mDPWidth = 0;
+	bool mDPValid = false;             // the table matches mEnergyMap
 };
 #endif
\ No newline at end of file
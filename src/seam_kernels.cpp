@@ -0,0 +1,202 @@
+#include "seam_kernels.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include "opencv2/core.hpp"
+#if defined(SEAM_KERNELS_SSE2)
+#include <emmintrin.h>
+#endif
+
+template <SeamEnergyType energy_type>
+void RelaxSeamRowScalar(const int32_t* prev, const uint16_t* energy, int32_t* cost, int8_t* parent, int width) noexcept
+{
+    using Traits = SeamEnergyTraits<energy_type>;
+    for (int x = 0; x < width; ++x) {
+        int32_t energy_best = prev[x - 1];
+        int8_t offset = -1;
+        if (Traits::Better(prev[x], energy_best)) {
+            energy_best = prev[x];
+            offset = 0;
+        }
+        if (Traits::Better(prev[x + 1], energy_best)) {
+            energy_best = prev[x + 1];
+            offset = 1;
+        }
+        cost[x] = energy[x] + energy_best;
+        parent[x] = offset;
+    }
+}
+
+void RelaxSeamRowForwardScalar(const int32_t* prev, const uint16_t* energy, const uint8_t* gray_up, const uint8_t* gray,
+    int32_t* cost, int8_t* parent, int begin, int end, int width) noexcept
+{
+    for (int x = begin; x < end; ++x) {
+        const int left = gray[x > 0 ? x - 1 : 0];
+        const int right = gray[x + 1 < width ? x + 1 : width - 1];
+        const int up = gray_up[x];
+        const int cost_up = std::abs(right - left);
+        int32_t energy_best = prev[x - 1] + (cost_up + std::abs(up - left));
+        int8_t offset = -1;
+        if (prev[x] + cost_up < energy_best) {
+            energy_best = prev[x] + cost_up;
+            offset = 0;
+        }
+        if (prev[x + 1] + (cost_up + std::abs(up - right)) < energy_best) {
+            energy_best = prev[x + 1] + (cost_up + std::abs(up - right));
+            offset = 1;
+        }
+        cost[x] = energy[x] + energy_best;
+        parent[x] = offset;
+    }
+}
+
+#if defined(SEAM_KERNELS_SSE2)
+template <SeamEnergyType energy_type>
+static inline __m128i BetterSse2(__m128i a, __m128i b) noexcept
+{
+    if constexpr (energy_type == SeamEnergyType::MIN_ENERGY)
+        return _mm_cmplt_epi32(a, b);
+    else
+        return _mm_cmpgt_epi32(a, b);
+}
+
+static inline __m128i SelectSse2(__m128i mask, __m128i a, __m128i b) noexcept
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static inline void StoreParentSse2(int8_t* parent, __m128i take_center, __m128i take_right) noexcept
+{
+    // compare masks are -1 where true: -1 - take_center gives -1 or 0, then take_right forces +1
+    __m128i offset = _mm_sub_epi32(_mm_set1_epi32(-1), take_center);
+    offset = SelectSse2(take_right, _mm_set1_epi32(1), offset);
+    offset = _mm_packs_epi32(offset, offset);
+    offset = _mm_packs_epi16(offset, offset);
+    int32_t packed = _mm_cvtsi128_si32(offset);
+    std::memcpy(parent, &packed, sizeof(packed));
+}
+
+template <SeamEnergyType energy_type>
+void RelaxSeamRowSse2(const int32_t* prev, const uint16_t* energy, int32_t* cost, int8_t* parent, int width) noexcept
+{
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + x - 1));
+        __m128i center = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + x));
+        __m128i right = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + x + 1));
+
+        __m128i take_center = BetterSse2<energy_type>(center, left);
+        __m128i best = SelectSse2(take_center, center, left);
+        __m128i take_right = BetterSse2<energy_type>(right, best);
+        best = SelectSse2(take_right, right, best);
+        __m128i pixels = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(energy + x)), zero);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(cost + x), _mm_add_epi32(pixels, best));
+        StoreParentSse2(parent + x, take_center, take_right);
+    }
+    RelaxSeamRowScalar<energy_type>(prev + x, energy + x, cost + x, parent + x, width - x);
+}
+
+static inline __m128i LoadGraySse2(const uint8_t* gray) noexcept
+{
+    // four gray pixels in the low 16-bit lanes
+    int32_t packed;
+    std::memcpy(&packed, gray, sizeof(packed));
+    return _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), _mm_setzero_si128());
+}
+
+static inline __m128i AbsDiffSse2(__m128i a, __m128i b) noexcept
+{
+    return _mm_max_epi16(_mm_sub_epi16(a, b), _mm_sub_epi16(b, a));
+}
+
+void RelaxSeamRowForwardSse2(const int32_t* prev, const uint16_t* energy, const uint8_t* gray_up, const uint8_t* gray,
+    int32_t* cost, int8_t* parent, int begin, int end, int width) noexcept
+{
+    // the border cells replicate their missing neighbour, only the inner cells are vectorized.
+    // The transition costs fit 16 bits and are widened next to the costs
+    int x = begin;
+    if (x == 0 && end > 0) {
+        RelaxSeamRowForwardScalar(prev, energy, gray_up, gray, cost, parent, 0, 1, width);
+        x = 1;
+    }
+    const int inner = std::min(end, width - 1);
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 4 <= inner; x += 4) {
+        __m128i gray_left = LoadGraySse2(gray + x - 1);
+        __m128i gray_right = LoadGraySse2(gray + x + 1);
+        __m128i gray_center = LoadGraySse2(gray_up + x);
+        __m128i cost_up = AbsDiffSse2(gray_right, gray_left);
+        __m128i cost_left = _mm_unpacklo_epi16(_mm_add_epi16(cost_up, AbsDiffSse2(gray_center, gray_left)), zero);
+        __m128i cost_right = _mm_unpacklo_epi16(_mm_add_epi16(cost_up, AbsDiffSse2(gray_center, gray_right)), zero);
+        cost_up = _mm_unpacklo_epi16(cost_up, zero);
+
+        __m128i left = _mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + x - 1)), cost_left);
+        __m128i center = _mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + x)), cost_up);
+        __m128i right = _mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + x + 1)), cost_right);
+
+        __m128i take_center = _mm_cmplt_epi32(center, left);
+        __m128i best = SelectSse2(take_center, center, left);
+        __m128i take_right = _mm_cmplt_epi32(right, best);
+        best = SelectSse2(take_right, right, best);
+        __m128i pixels = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(energy + x)), zero);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(cost + x), _mm_add_epi32(pixels, best));
+        StoreParentSse2(parent + x, take_center, take_right);
+    }
+    RelaxSeamRowForwardScalar(prev, energy, gray_up, gray, cost, parent, x, end, width);
+}
+#endif
+
+using RelaxSeamRowFunc = void (*)(const int32_t*, const uint16_t*, int32_t*, int8_t*, int) noexcept;
+
+template <SeamEnergyType energy_type>
+static RelaxSeamRowFunc SelectRelaxSeamRow() noexcept
+{
+#if defined(SEAM_KERNELS_AVX2)
+    if (cv::checkHardwareSupport(CV_CPU_AVX2))
+        return RelaxSeamRowAvx2<energy_type>;
+#endif
+#if defined(SEAM_KERNELS_SSE2)
+    return RelaxSeamRowSse2<energy_type>;
+#else
+    return RelaxSeamRowScalar<energy_type>;
+#endif
+}
+
+template <SeamEnergyType energy_type>
+void RelaxSeamRow(const int32_t* prev, const uint16_t* energy, int32_t* cost, int8_t* parent, int width) noexcept
+{
+    static const RelaxSeamRowFunc kernel = SelectRelaxSeamRow<energy_type>();
+    kernel(prev, energy, cost, parent, width);
+}
+
+using RelaxSeamRowForwardFunc = void (*)(const int32_t*, const uint16_t*, const uint8_t*, const uint8_t*, int32_t*, int8_t*, int, int, int) noexcept;
+
+static RelaxSeamRowForwardFunc SelectRelaxSeamRowForward() noexcept
+{
+#if defined(SEAM_KERNELS_AVX2)
+    if (cv::checkHardwareSupport(CV_CPU_AVX2))
+        return RelaxSeamRowForwardAvx2;
+#endif
+#if defined(SEAM_KERNELS_SSE2)
+    return RelaxSeamRowForwardSse2;
+#else
+    return RelaxSeamRowForwardScalar;
+#endif
+}
+
+void RelaxSeamRowForward(const int32_t* prev, const uint16_t* energy, const uint8_t* gray_up, const uint8_t* gray,
+    int32_t* cost, int8_t* parent, int begin, int end, int width) noexcept
+{
+    static const RelaxSeamRowForwardFunc kernel = SelectRelaxSeamRowForward();
+    kernel(prev, energy, gray_up, gray, cost, parent, begin, end, width);
+}
+
+template void RelaxSeamRow<SeamEnergyType::MIN_ENERGY>(const int32_t*, const uint16_t*, int32_t*, int8_t*, int) noexcept;
+template void RelaxSeamRow<SeamEnergyType::MAX_ENERGY>(const int32_t*, const uint16_t*, int32_t*, int8_t*, int) noexcept;
+template void RelaxSeamRowScalar<SeamEnergyType::MIN_ENERGY>(const int32_t*, const uint16_t*, int32_t*, int8_t*, int) noexcept;
+template void RelaxSeamRowScalar<SeamEnergyType::MAX_ENERGY>(const int32_t*, const uint16_t*, int32_t*, int8_t*, int) noexcept;
+#if defined(SEAM_KERNELS_SSE2)
+template void RelaxSeamRowSse2<SeamEnergyType::MIN_ENERGY>(const int32_t*, const uint16_t*, int32_t*, int8_t*, int) noexcept;
+template void RelaxSeamRowSse2<SeamEnergyType::MAX_ENERGY>(const int32_t*, const uint16_t*, int32_t*, int8_t*, int) noexcept;
+#endif
@@ -0,0 +1,68 @@
+#ifndef _SEAM_KERNELS_H_
+#define _SEAM_KERNELS_H_
+#include <cstdint>
+#include <limits>
+#include "seam_carver.h"
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SEAM_KERNELS_SSE2
+#endif
+
+template <SeamEnergyType energy_type>
+struct SeamEnergyTraits;
+
+// Energies are uint16_t, cumulative costs int32_t: a row adds at most 65535, so costs starting from a
+// sentinel stay far from overflow and every compare can be a signed one (SSE2 has no unsigned compares)
+template <>
+struct SeamEnergyTraits<SeamEnergyType::MIN_ENERGY>
+{
+	static constexpr int32_t worst = std::numeric_limits<int32_t>::max() / 2;
+	static bool Better(int32_t a, int32_t b) noexcept { return a < b; }
+};
+
+template <>
+struct SeamEnergyTraits<SeamEnergyType::FORWARD_ENERGY> : SeamEnergyTraits<SeamEnergyType::MIN_ENERGY>
+{
+};
+
+template <>
+struct SeamEnergyTraits<SeamEnergyType::MAX_ENERGY>
+{
+	static constexpr int32_t worst = std::numeric_limits<int32_t>::min() / 2;
+	static bool Better(int32_t a, int32_t b) noexcept { return a > b; }
+};
+
+// One dp row: cost[x] = energy[x] + best(prev[x-1], prev[x], prev[x+1]) and parent[x] = offset of the best.
+// prev[-1] and prev[width] must hold SeamEnergyTraits<energy_type>::worst. Ties go to the leftmost parent.
+template <SeamEnergyType energy_type>
+void RelaxSeamRow(const int32_t* prev, const uint16_t* energy, int32_t* cost, int8_t* parent, int width) noexcept;
+
+template <SeamEnergyType energy_type>
+void RelaxSeamRowScalar(const int32_t* prev, const uint16_t* energy, int32_t* cost, int8_t* parent, int width) noexcept;
+#if defined(SEAM_KERNELS_SSE2)
+template <SeamEnergyType energy_type>
+void RelaxSeamRowSse2(const int32_t* prev, const uint16_t* energy, int32_t* cost, int8_t* parent, int width) noexcept;
+#endif
+#if defined(SEAM_KERNELS_AVX2)
+template <SeamEnergyType energy_type>
+void RelaxSeamRowAvx2(const int32_t* prev, const uint16_t* energy, int32_t* cost, int8_t* parent, int width) noexcept;
+#endif
+
+// Forward energy dp over the cells [begin, end) of a row of `width` pixels, all pointers point at column 0.
+// With L, R the gray neighbours of x and U = gray_up[x] of the previous row (borders replicated):
+// cost[x] = energy[x] + min(prev[x-1] + |R-L| + |U-L|, prev[x] + |R-L|, prev[x+1] + |R-L| + |U-R|).
+// Sentinels and ties as in RelaxSeamRow.
+void RelaxSeamRowForward(const int32_t* prev, const uint16_t* energy, const uint8_t* gray_up, const uint8_t* gray,
+	int32_t* cost, int8_t* parent, int begin, int end, int width) noexcept;
+
+void RelaxSeamRowForwardScalar(const int32_t* prev, const uint16_t* energy, const uint8_t* gray_up, const uint8_t* gray,
+	int32_t* cost, int8_t* parent, int begin, int end, int width) noexcept;
+#if defined(SEAM_KERNELS_SSE2)
+void RelaxSeamRowForwardSse2(const int32_t* prev, const uint16_t* energy, const uint8_t* gray_up, const uint8_t* gray,
+	int32_t* cost, int8_t* parent, int begin, int end, int width) noexcept;
+#endif
+#if defined(SEAM_KERNELS_AVX2)
+void RelaxSeamRowForwardAvx2(const int32_t* prev, const uint16_t* energy, const uint8_t* gray_up, const uint8_t* gray,
+	int32_t* cost, int8_t* parent, int begin, int end, int width) noexcept;
+#endif
+#endif
@@ -0,0 +1,93 @@
+// Compiled with AVX2 code generation (see CMakeLists.txt) and only called after a runtime cpu check.
+// Keep this file free of inline helpers shared with other translation units: the linker may pick the
+// AVX2 copy of such a function for callers running on cpus without AVX2.
+#include "seam_kernels.h"
+#if defined(SEAM_KERNELS_AVX2)
+#include <immintrin.h>
+
+template <SeamEnergyType energy_type>
+void RelaxSeamRowAvx2(const int32_t* prev, const uint16_t* energy, int32_t* cost, int8_t* parent, int width) noexcept
+{
+    const __m256i minus_one = _mm256_set1_epi32(-1);
+    const __m256i one = _mm256_set1_epi32(1);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256i left = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev + x - 1));
+        __m256i center = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev + x));
+        __m256i right = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev + x + 1));
+
+        // there is only a signed greater-than: a < b is b > a
+        __m256i take_center = energy_type == SeamEnergyType::MIN_ENERGY ? _mm256_cmpgt_epi32(left, center) : _mm256_cmpgt_epi32(center, left);
+        __m256i best = _mm256_blendv_epi8(left, center, take_center);
+        __m256i take_right = energy_type == SeamEnergyType::MIN_ENERGY ? _mm256_cmpgt_epi32(best, right) : _mm256_cmpgt_epi32(right, best);
+        best = _mm256_blendv_epi8(best, right, take_right);
+        __m256i pixels = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(energy + x)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(cost + x), _mm256_add_epi32(pixels, best));
+
+        __m256i offset = _mm256_sub_epi32(minus_one, take_center);
+        offset = _mm256_blendv_epi8(offset, one, take_right);
+        // packs work per 128-bit lane, so each lane ends up with its four offsets in the low dword
+        offset = _mm256_packs_epi32(offset, offset);
+        offset = _mm256_packs_epi16(offset, offset);
+        __m128i packed = _mm_unpacklo_epi32(_mm256_castsi256_si128(offset), _mm256_extracti128_si256(offset, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(parent + x), packed);
+    }
+    for (; x < width; ++x) {
+        int32_t energy_best = prev[x - 1];
+        int8_t offset = -1;
+        if (energy_type == SeamEnergyType::MIN_ENERGY ? prev[x] < energy_best : prev[x] > energy_best) {
+            energy_best = prev[x];
+            offset = 0;
+        }
+        if (energy_type == SeamEnergyType::MIN_ENERGY ? prev[x + 1] < energy_best : prev[x + 1] > energy_best) {
+            energy_best = prev[x + 1];
+            offset = 1;
+        }
+        cost[x] = energy[x] + energy_best;
+        parent[x] = offset;
+    }
+}
+
+template void RelaxSeamRowAvx2<SeamEnergyType::MIN_ENERGY>(const int32_t*, const uint16_t*, int32_t*, int8_t*, int) noexcept;
+template void RelaxSeamRowAvx2<SeamEnergyType::MAX_ENERGY>(const int32_t*, const uint16_t*, int32_t*, int8_t*, int) noexcept;
+
+void RelaxSeamRowForwardAvx2(const int32_t* prev, const uint16_t* energy, const uint8_t* gray_up, const uint8_t* gray,
+    int32_t* cost, int8_t* parent, int begin, int end, int width) noexcept
+{
+    int x = begin;
+    if (x == 0 && end > 0) {
+        RelaxSeamRowForwardScalar(prev, energy, gray_up, gray, cost, parent, 0, 1, width);
+        x = 1;
+    }
+    const int inner = end < width - 1 ? end : width - 1;
+    const __m256i minus_one = _mm256_set1_epi32(-1);
+    const __m256i one = _mm256_set1_epi32(1);
+    for (; x + 8 <= inner; x += 8) {
+        __m256i gray_left = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(gray + x - 1)));
+        __m256i gray_right = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(gray + x + 1)));
+        __m256i gray_center = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(gray_up + x)));
+        __m256i cost_up = _mm256_abs_epi32(_mm256_sub_epi32(gray_right, gray_left));
+        __m256i cost_left = _mm256_add_epi32(cost_up, _mm256_abs_epi32(_mm256_sub_epi32(gray_center, gray_left)));
+        __m256i cost_right = _mm256_add_epi32(cost_up, _mm256_abs_epi32(_mm256_sub_epi32(gray_center, gray_right)));
+
+        __m256i left = _mm256_add_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev + x - 1)), cost_left);
+        __m256i center = _mm256_add_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev + x)), cost_up);
+        __m256i right = _mm256_add_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev + x + 1)), cost_right);
+
+        __m256i take_center = _mm256_cmpgt_epi32(left, center);
+        __m256i best = _mm256_blendv_epi8(left, center, take_center);
+        __m256i take_right = _mm256_cmpgt_epi32(best, right);
+        best = _mm256_blendv_epi8(best, right, take_right);
+        __m256i pixels = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(energy + x)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(cost + x), _mm256_add_epi32(pixels, best));
+
+        __m256i offset = _mm256_sub_epi32(minus_one, take_center);
+        offset = _mm256_blendv_epi8(offset, one, take_right);
+        offset = _mm256_packs_epi32(offset, offset);
+        offset = _mm256_packs_epi16(offset, offset);
+        __m128i packed = _mm_unpacklo_epi32(_mm256_castsi256_si128(offset), _mm256_extracti128_si256(offset, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(parent + x), packed);
+    }
+    RelaxSeamRowForwardScalar(prev, energy, gray_up, gray, cost, parent, x, end, width);
+}
+#endif